@@ -1,25 +1,66 @@
+#ifndef _WIN32
+#define _FILE_OFFSET_BITS 64                    // 32位系统上off_t也为64位
+#endif
+
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
 #include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include "xdisk.h"
 #include "xfat.h"
+#include "driver.h"
+
+// 按64位偏移定位，超过4GB的映像不会回绕
+static int disk_seek(FILE* file, u64_t offset, int origin) {
+#ifdef _WIN32
+	return _fseeki64(file, (__int64)offset, origin);
+#else
+	return fseeko(file, (off_t)offset, origin);
+#endif
+}
+
+static u64_t disk_tell(FILE* file) {
+#ifdef _WIN32
+	return (u64_t)_ftelli64(file);
+#else
+	return (u64_t)ftello(file);
+#endif
+}
+
+static xfat_err_t disk_probe_read(void* data, u8_t* buffer, u64_t offset) {
+	FILE* file = (FILE*)data;
+	if (disk_seek(file, offset, SEEK_SET) == -1) {
+		return FS_ERR_IO;
+	}
+	return (fread(buffer, XDISK_SECTOR_SIZE_MIN, 1, file) == 1) ? FS_ERR_OK : FS_ERR_IO;
+}
 
 static xfat_err_t xdisk_hw_open(struct _xdisk_t* disk, void* init_data) {
+	static u8_t probe_buf[XDISK_SECTOR_SIZE_MIN];
 	const char* path = (const char*)init_data;
 	FILE* file = fopen(path, "rb+");
 	if (file == NULL) {
+#ifdef _WIN32
 		char buffer[128];
 		strerror_s(buffer, 128, errno);
 		printf("open disk failed: %s, reason: %s\n", path, buffer);
+#else
+		printf("open disk failed: %s, reason: %s\n", path, strerror(errno));
+#endif
 		return FS_ERR_IO;
 	}
 
-	disk->data = file;
-	disk->sector_size = 512;
+	disk_seek(file, 0, SEEK_END);
+	u64_t disk_size = disk_tell(file);
 
-	fseek(file, 0, SEEK_END);
-	disk->total_sector = ftell(file) / disk->sector_size;
+	disk->data = file;
+	disk->sector_size = xdisk_probe_sector_size(disk_probe_read, file, probe_buf, disk_size);
+	disk->total_sector = xdisk_size_to_sectors(disk, disk_size);
 	return FS_ERR_OK;
 }
 
@@ -30,12 +71,12 @@ static xfat_err_t xdisk_hw_close(struct _xdisk_t* disk) {
 }
 
 static xfat_err_t xdisk_hw_read_sector(struct _xdisk_t* disk, u8_t* buffer, u32_t start_sector, u32_t count) {
-	u32_t offset = start_sector * disk->sector_size;
+	u64_t offset = xdisk_sector_offset(disk, start_sector);
 	FILE* file = (FILE*)disk->data;
 
-	xfat_err_t err = fseek(file, offset, SEEK_SET);
+	xfat_err_t err = disk_seek(file, offset, SEEK_SET);
 	if (err == -1) {
-		printf("seek disk failed: 0x%x\n", offset);
+		printf("seek disk failed: 0x%llx\n", (unsigned long long)offset);
 		return FS_ERR_IO;
 	}
 	err = (xfat_err_t)fread(buffer, disk->sector_size, count, file);
@@ -47,12 +88,12 @@ static xfat_err_t xdisk_hw_read_sector(struct _xdisk_t* disk, u8_t* buffer, u32_
 }
 
 static xfat_err_t xdisk_hw_write_sector(struct _xdisk_t* disk, u8_t* buffer, u32_t start_sector, u32_t count) {
-	u32_t offset = start_sector * disk->sector_size;
+	u64_t offset = xdisk_sector_offset(disk, start_sector);
 	FILE* file = (FILE*)disk->data;
 
-	xfat_err_t err = fseek(file, offset, SEEK_SET);
+	xfat_err_t err = disk_seek(file, offset, SEEK_SET);
 	if (err == -1) {
-		printf("seek disk failed: 0x%x\n", offset);
+		printf("seek disk failed: 0x%llx\n", (unsigned long long)offset);
 		return FS_ERR_IO;
 	}
 	err = (xfat_err_t)fwrite(buffer, disk->sector_size, count, file);
@@ -60,7 +101,55 @@ static xfat_err_t xdisk_hw_write_sector(struct _xdisk_t* disk, u8_t* buffer, u32
 		printf("write disk failed: sector: %d, count: %d\n", start_sector, count);
 		return FS_ERR_IO;
 	}
-	fflush(file);
+	return FS_ERR_OK;
+}
+
+// 分散/聚集读写只需定位一次，各段依次读写
+static xfat_err_t xdisk_hw_rw_vector(struct _xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector, u8_t is_write) {
+	u64_t offset = xdisk_sector_offset(disk, start_sector);
+	FILE* file = (FILE*)disk->data;
+
+	if (disk_seek(file, offset, SEEK_SET) == -1) {
+		printf("seek disk failed: 0x%llx\n", (unsigned long long)offset);
+		return FS_ERR_IO;
+	}
+
+	for (u32_t i = 0; i < iov_count; i++) {
+		size_t size = is_write ? fwrite(iov[i].buffer, 1, iov[i].size, file) : fread(iov[i].buffer, 1, iov[i].size, file);
+		if (size != iov[i].size) {
+			printf("%s disk failed: sector: %d, count: %d\n", is_write ? "write" : "read",
+				start_sector, iov[i].size / disk->sector_size);
+			return FS_ERR_IO;
+		}
+		start_sector += iov[i].size / disk->sector_size;
+	}
+
+	return FS_ERR_OK;
+}
+
+static xfat_err_t xdisk_hw_readv(struct _xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector) {
+	return xdisk_hw_rw_vector(disk, iov, iov_count, start_sector, 0);
+}
+
+static xfat_err_t xdisk_hw_writev(struct _xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector) {
+	return xdisk_hw_rw_vector(disk, iov, iov_count, start_sector, 1);
+}
+
+// 写入只留在stdio及系统缓冲中，由上层在持久化点调用同步
+static xfat_err_t xdisk_hw_sync(struct _xdisk_t* disk) {
+	FILE* file = (FILE*)disk->data;
+	if (fflush(file) != 0) {
+		printf("flush disk failed\n");
+		return FS_ERR_IO;
+	}
+#ifdef _WIN32
+	if (_commit(_fileno(file)) != 0) {
+#else
+	if (fsync(fileno(file)) != 0) {
+#endif
+		printf("sync disk failed\n");
+		return FS_ERR_IO;
+	}
 	return FS_ERR_OK;
 }
 
@@ -87,4 +176,7 @@ xdisk_driver_t vdisk_driver = {
 	.curr_time = curr_time,
 	.read_sector = xdisk_hw_read_sector,
 	.write_sector = xdisk_hw_write_sector,
+	.readv = xdisk_hw_readv,
+	.writev = xdisk_hw_writev,
+	.sync = xdisk_hw_sync,
 };
\ No newline at end of file
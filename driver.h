@@ -0,0 +1,14 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "xdisk.h"
+
+extern xdisk_driver_t vdisk_driver;                 // 用标准文件接口读写的磁盘映像
+
+#ifndef _WIN32
+extern xdisk_driver_t posix_disk_driver;            // 用pread/pwrite读写磁盘映像或块设备
+extern xdisk_driver_t posix_direct_disk_driver;     // 同上，以O_DIRECT打开，不经过系统页缓存
+extern xdisk_driver_t posix_mmap_disk_driver;       // 将整个映像映射到内存
+#endif
+
+#endif // !DRIVER_H
@@ -0,0 +1,1002 @@
+#ifndef _WIN32
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define _FILE_OFFSET_BITS 64                    // 32位系统上off_t也为64位
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#include "xdisk.h"
+#include "xfat.h"
+#include "driver.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define POSIX_DISK_URING
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#define POSIX_DISK_ALIGN        4096            // O_DIRECT要求的缓冲区、偏移及长度对齐
+#define POSIX_DISK_BOUNCE_SIZE  (64 * 1024)     // 缓冲区未对齐时每次中转的最大字节数
+
+#define POSIX_DISK_IOV_MAX      64              // 每次preadv/pwritev最多传递的缓冲区段数
+#define POSIX_DISK_QUEUE_DEPTH  32              // io_uring的提交队列深度
+#define POSIX_DISK_WORKERS      4               // 不能使用io_uring时执行异步请求的线程数
+
+#define POSIX_DISK_DIRECT       (1 << 0)        // 以O_DIRECT打开
+#define POSIX_DISK_MMAP         (1 << 1)        // 将整个映像映射到内存
+
+typedef enum _posix_async_t {
+	POSIX_ASYNC_NONE,                           // 尚未提交过异步请求
+	POSIX_ASYNC_URING,
+	POSIX_ASYNC_THREAD,
+	POSIX_ASYNC_SYNC,                           // 两者都不可用，提交时同步执行
+} posix_async_t;
+
+#ifdef POSIX_DISK_URING
+typedef struct _posix_uring_t {
+	int fd;
+	u8_t* sq_ring;
+	size_t sq_ring_size;
+	u8_t* cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+	u32_t* sq_head, * sq_tail, * sq_mask, * sq_array;
+	u32_t* cq_head, * cq_tail, * cq_mask;
+	struct io_uring_cqe* cqes;
+	u32_t sq_entries;
+	u32_t inflight;
+} posix_uring_t;
+#endif
+
+typedef struct _posix_workers_t {
+	pthread_t threads[POSIX_DISK_WORKERS];
+	u32_t thread_count;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;                        // 有新请求或需要退出
+	pthread_cond_t done_cond;                   // 有请求完成
+	xdisk_io_t* head, * tail;                   // 待执行的请求
+	u32_t inflight;                             // 已提交未完成的请求数
+	u8_t quit;
+} posix_workers_t;
+
+typedef struct _posix_disk_t {
+	int fd;
+	u8_t direct;
+	u8_t block_dev;                             // 打开的是块设备而非映像文件
+	u8_t* map;                                  // 映像的内存映射，未映射时为0
+	size_t map_size;
+
+	posix_async_t async;
+#ifdef POSIX_DISK_URING
+	posix_uring_t uring;
+#endif
+	posix_workers_t workers;
+} posix_disk_t;
+
+static xfat_err_t posix_probe_read(void* data, u8_t* buffer, u64_t offset) {
+	posix_disk_t* posix_disk = (posix_disk_t*)data;
+	void* sector;
+	ssize_t size;
+
+	if (posix_disk->map) {
+		if (offset + XDISK_SECTOR_SIZE_MIN > posix_disk->map_size) {
+			return FS_ERR_PARAM;
+		}
+		memcpy(buffer, posix_disk->map + offset, XDISK_SECTOR_SIZE_MIN);
+		return FS_ERR_OK;
+	}
+
+	// 按O_DIRECT的对齐要求整块读取，探测的偏移均为4K的整数倍
+	if (posix_memalign(&sector, POSIX_DISK_ALIGN, POSIX_DISK_ALIGN) != 0) {
+		return FS_ERR_MEM;
+	}
+	size = pread(posix_disk->fd, sector, POSIX_DISK_ALIGN, (off_t)offset);
+	if (size >= XDISK_SECTOR_SIZE_MIN) {
+		memcpy(buffer, sector, XDISK_SECTOR_SIZE_MIN);
+	}
+	free(sector);
+	return (size >= XDISK_SECTOR_SIZE_MIN) ? FS_ERR_OK : FS_ERR_IO;
+}
+
+/**
+ * 块设备向内核查询逻辑扇区大小，映像文件则依据其中已有的文件系统推测
+ */
+static u32_t posix_sector_size(posix_disk_t* posix_disk, struct stat* st, u64_t disk_size) {
+	static u8_t probe_buf[XDISK_SECTOR_SIZE_MIN];
+#ifdef BLKSSZGET
+	int size;
+	if (S_ISBLK(st->st_mode) && (ioctl(posix_disk->fd, BLKSSZGET, &size) == 0)) {
+		return (u32_t)size;
+	}
+#endif
+	return xdisk_probe_sector_size(posix_probe_read, posix_disk, probe_buf, disk_size);
+}
+
+/**
+ * 打开磁盘映像，用pread/pwrite按绝对偏移读写，不共享文件位置，多个扇区请求可并发执行
+ * @param mode POSIX_DISK_DIRECT：绕过系统页缓存；POSIX_DISK_MMAP：映射整个映像，扇区读写变为内存拷贝
+ */
+static xfat_err_t posix_disk_open(struct _xdisk_t* disk, const char* path, u32_t mode) {
+	int flags = O_RDWR;
+	u8_t direct = 0;
+#ifdef O_DIRECT
+	if (mode & POSIX_DISK_DIRECT) {
+		flags |= O_DIRECT;
+		direct = 1;
+	}
+#endif
+
+	int fd = open(path, flags);
+	if (fd < 0) {
+		printf("open disk failed: %s, reason: %s\n", path, strerror(errno));
+		return FS_ERR_IO;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		printf("stat disk failed: %s, reason: %s\n", path, strerror(errno));
+		close(fd);
+		return FS_ERR_IO;
+	}
+
+	u64_t disk_size = (u64_t)st.st_size;
+#ifdef BLKGETSIZE64
+	if (S_ISBLK(st.st_mode) && (ioctl(fd, BLKGETSIZE64, &disk_size) < 0)) {
+		disk_size = 0;
+	}
+#endif
+
+	posix_disk_t* posix_disk = (posix_disk_t*)malloc(sizeof(posix_disk_t));
+	if (posix_disk == (posix_disk_t*)0) {
+		close(fd);
+		return FS_ERR_MEM;
+	}
+	posix_disk->fd = fd;
+	posix_disk->direct = direct;
+	posix_disk->block_dev = S_ISBLK(st.st_mode) ? 1 : 0;
+	posix_disk->map = (u8_t*)0;
+	posix_disk->map_size = 0;
+	posix_disk->async = POSIX_ASYNC_NONE;
+
+	// 映像需能放入地址空间
+	if (mode & POSIX_DISK_MMAP) {
+		void* map = MAP_FAILED;
+		if ((disk_size > 0) && (disk_size <= (size_t)-1)) {
+			map = mmap((void*)0, (size_t)disk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		if (map == MAP_FAILED) {
+			printf("map disk failed: %s, reason: %s\n", path, strerror(errno));
+			free(posix_disk);
+			close(fd);
+			return FS_ERR_IO;
+		}
+
+		posix_disk->map = (u8_t*)map;
+		posix_disk->map_size = (size_t)disk_size;
+	}
+
+	disk->data = posix_disk;
+	disk->sector_size = posix_sector_size(posix_disk, &st, disk_size);
+	disk->total_sector = xdisk_size_to_sectors(disk, disk_size);
+	return FS_ERR_OK;
+}
+
+static xfat_err_t posix_hw_open(struct _xdisk_t* disk, void* init_data) {
+	return posix_disk_open(disk, (const char*)init_data, 0);
+}
+
+static xfat_err_t posix_hw_open_direct(struct _xdisk_t* disk, void* init_data) {
+	return posix_disk_open(disk, (const char*)init_data, POSIX_DISK_DIRECT);
+}
+
+static xfat_err_t posix_hw_open_mmap(struct _xdisk_t* disk, void* init_data) {
+	return posix_disk_open(disk, (const char*)init_data, POSIX_DISK_MMAP);
+}
+
+static void posix_async_close(struct _xdisk_t* disk);
+
+static xfat_err_t posix_hw_close(struct _xdisk_t* disk) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+	posix_async_close(disk);
+	if (posix_disk->map) {
+		msync(posix_disk->map, posix_disk->map_size, MS_SYNC);
+		munmap(posix_disk->map, posix_disk->map_size);
+	}
+	close(posix_disk->fd);
+	free(posix_disk);
+	return FS_ERR_OK;
+}
+
+// 读写完整的size字节，被信号中断或只完成部分时继续
+static xfat_err_t posix_disk_io(int fd, u8_t* buffer, size_t size, off_t offset, u8_t is_write) {
+	while (size > 0) {
+		ssize_t ret = is_write ? pwrite(fd, buffer, size, offset) : pread(fd, buffer, size, offset);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return FS_ERR_IO;
+		}
+		if (ret == 0) {
+			return FS_ERR_IO;
+		}
+
+		buffer += ret;
+		size -= (size_t)ret;
+		offset += ret;
+	}
+	return FS_ERR_OK;
+}
+
+static xfat_err_t posix_disk_rw(struct _xdisk_t* disk, u8_t* buffer, u32_t start_sector, u32_t count, u8_t is_write) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+	off_t offset = (off_t)xdisk_sector_offset(disk, start_sector);
+	size_t size = (size_t)count * disk->sector_size;
+
+	// 已映射时直接拷贝，缓冲区本身就是映射中的对应位置时（缓存池直通模式）无需任何操作
+	if (posix_disk->map) {
+		u8_t* map = posix_disk->map + offset;
+		if (buffer != map) {
+			memmove(is_write ? map : buffer, is_write ? buffer : map, size);
+		}
+		return FS_ERR_OK;
+	}
+
+	if (!posix_disk->direct || (((size_t)buffer % POSIX_DISK_ALIGN) == 0)) {
+		return posix_disk_io(posix_disk->fd, buffer, size, offset, is_write);
+	}
+
+	// O_DIRECT下缓存池中的缓冲区一般未对齐，经对齐的中转缓冲分段读写。中转缓冲每次调用单独分配，保证可并发
+	size_t bounce_size = (size < POSIX_DISK_BOUNCE_SIZE) ? size : POSIX_DISK_BOUNCE_SIZE;
+	void* bounce;
+	if (posix_memalign(&bounce, POSIX_DISK_ALIGN, bounce_size) != 0) {
+		return FS_ERR_MEM;
+	}
+
+	xfat_err_t err = FS_ERR_OK;
+	while ((size > 0) && (err == FS_ERR_OK)) {
+		size_t curr_size = (size < bounce_size) ? size : bounce_size;
+		if (is_write) {
+			memcpy(bounce, buffer, curr_size);
+			err = posix_disk_io(posix_disk->fd, (u8_t*)bounce, curr_size, offset, 1);
+		}
+		else {
+			err = posix_disk_io(posix_disk->fd, (u8_t*)bounce, curr_size, offset, 0);
+			memcpy(buffer, bounce, curr_size);
+		}
+
+		buffer += curr_size;
+		offset += curr_size;
+		size -= curr_size;
+	}
+
+	free(bounce);
+	return err;
+}
+
+// 读写完整的各段缓冲区，只完成部分时跳过已完成的部分继续。会修改iov
+static xfat_err_t posix_disk_iov_io(int fd, struct iovec* iov, int iov_count, off_t offset, u8_t is_write) {
+	while (iov_count > 0) {
+		ssize_t ret = is_write ? pwritev(fd, iov, iov_count, offset) : preadv(fd, iov, iov_count, offset);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return FS_ERR_IO;
+		}
+		if (ret == 0) {
+			return FS_ERR_IO;
+		}
+
+		offset += ret;
+		while ((iov_count > 0) && ((size_t)ret >= iov->iov_len)) {
+			ret -= (ssize_t)iov->iov_len;
+			iov++;
+			iov_count--;
+		}
+		if (iov_count > 0) {
+			iov->iov_base = (u8_t*)iov->iov_base + ret;
+			iov->iov_len -= (size_t)ret;
+		}
+	}
+	return FS_ERR_OK;
+}
+
+// 在各段缓冲区与连续的data之间拷贝size字节，index、iov_offset记录当前位置
+static void posix_iov_copy(xdisk_iovec_t* iov, u32_t* index, size_t* iov_offset, u8_t* data, size_t size, u8_t to_iov) {
+	while (size > 0) {
+		size_t curr_size = iov[*index].size - *iov_offset;
+		if (curr_size > size) {
+			curr_size = size;
+		}
+
+		u8_t* buffer = iov[*index].buffer + *iov_offset;
+		memcpy(to_iov ? buffer : data, to_iov ? data : buffer, curr_size);
+		data += curr_size;
+		size -= curr_size;
+		*iov_offset += curr_size;
+		if (*iov_offset == iov[*index].size) {
+			(*index)++;
+			*iov_offset = 0;
+		}
+	}
+}
+
+/**
+ * 分散/聚集读写，skip为开头已完成的字节数。一般情况下每POSIX_DISK_IOV_MAX段用一次preadv/pwritev；
+ * 已映射时逐段拷贝；O_DIRECT下经对齐的中转缓冲合并读写
+ */
+static xfat_err_t posix_disk_rwv(struct _xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector,
+	size_t skip, u8_t is_write) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+	off_t offset = (off_t)xdisk_sector_offset(disk, start_sector);
+
+	while ((iov_count > 0) && (skip >= iov->size)) {
+		skip -= iov->size;
+		offset += iov->size;
+		iov++;
+		iov_count--;
+	}
+
+	// 只完成了一部分的段单独补完
+	if ((iov_count > 0) && (skip > 0)) {
+		xfat_err_t err = posix_disk_io(posix_disk->fd, iov->buffer + skip, iov->size - skip, offset + (off_t)skip, is_write);
+		if (err < 0) {
+			return err;
+		}
+		offset += iov->size;
+		iov++;
+		iov_count--;
+	}
+
+	if (posix_disk->map) {
+		for (u32_t i = 0; i < iov_count; i++) {
+			posix_disk_rw(disk, iov[i].buffer, (u32_t)(offset / disk->sector_size), iov[i].size / disk->sector_size, is_write);
+			offset += iov[i].size;
+		}
+		return FS_ERR_OK;
+	}
+
+	if (posix_disk->direct) {
+		size_t size = 0;
+		for (u32_t i = 0; i < iov_count; i++) {
+			size += iov[i].size;
+		}
+		if (size == 0) {
+			return FS_ERR_OK;
+		}
+
+		size_t bounce_size = (size < POSIX_DISK_BOUNCE_SIZE) ? size : POSIX_DISK_BOUNCE_SIZE;
+		void* bounce;
+		if (posix_memalign(&bounce, POSIX_DISK_ALIGN, bounce_size) != 0) {
+			return FS_ERR_MEM;
+		}
+
+		u32_t index = 0;
+		size_t iov_offset = 0;
+		xfat_err_t err = FS_ERR_OK;
+		while ((size > 0) && (err == FS_ERR_OK)) {
+			size_t curr_size = (size < bounce_size) ? size : bounce_size;
+			if (is_write) {
+				posix_iov_copy(iov, &index, &iov_offset, (u8_t*)bounce, curr_size, 0);
+				err = posix_disk_io(posix_disk->fd, (u8_t*)bounce, curr_size, offset, 1);
+			}
+			else {
+				err = posix_disk_io(posix_disk->fd, (u8_t*)bounce, curr_size, offset, 0);
+				posix_iov_copy(iov, &index, &iov_offset, (u8_t*)bounce, curr_size, 1);
+			}
+
+			offset += curr_size;
+			size -= curr_size;
+		}
+
+		free(bounce);
+		return err;
+	}
+
+	while (iov_count > 0) {
+		struct iovec sys_iov[POSIX_DISK_IOV_MAX];
+		u32_t curr_count = (iov_count > POSIX_DISK_IOV_MAX) ? POSIX_DISK_IOV_MAX : iov_count;
+		size_t size = 0;
+		for (u32_t i = 0; i < curr_count; i++) {
+			sys_iov[i].iov_base = iov[i].buffer;
+			sys_iov[i].iov_len = iov[i].size;
+			size += iov[i].size;
+		}
+
+		xfat_err_t err = posix_disk_iov_io(posix_disk->fd, sys_iov, (int)curr_count, offset, is_write);
+		if (err < 0) {
+			return err;
+		}
+
+		offset += size;
+		iov += curr_count;
+		iov_count -= curr_count;
+	}
+	return FS_ERR_OK;
+}
+
+static xfat_err_t posix_hw_read_sector(struct _xdisk_t* disk, u8_t* buffer, u32_t start_sector, u32_t count) {
+	xfat_err_t err = posix_disk_rw(disk, buffer, start_sector, count, 0);
+	if (err < 0) {
+		printf("read disk failed: sector: %u, count: %u, reason: %s\n", start_sector, count, strerror(errno));
+	}
+	return err;
+}
+
+static xfat_err_t posix_hw_write_sector(struct _xdisk_t* disk, u8_t* buffer, u32_t start_sector, u32_t count) {
+	xfat_err_t err = posix_disk_rw(disk, buffer, start_sector, count, 1);
+	if (err < 0) {
+		printf("write disk failed: sector: %u, count: %u, reason: %s\n", start_sector, count, strerror(errno));
+	}
+	return err;
+}
+
+#ifdef POSIX_DISK_URING
+/**
+ * 直接用系统调用建立io_uring，不依赖liburing。IORING_OP_READ/WRITE自5.6起支持，
+ * 以5.7加入的IORING_FEAT_FAST_POLL作为内核版本足够新的依据。
+ * 另要求IORING_FEAT_SUBMIT_STABLE，READV/WRITEV的iovec数组只需在提交期间有效
+ */
+static int posix_uring_init(posix_uring_t* ring) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = (int)syscall(__NR_io_uring_setup, POSIX_DISK_QUEUE_DEPTH, &params);
+	if (fd < 0) {
+		return -1;
+	}
+	u32_t features = IORING_FEAT_FAST_POLL | IORING_FEAT_SUBMIT_STABLE;
+	if ((params.features & features) != features) {
+		close(fd);
+		return -1;
+	}
+
+	ring->fd = fd;
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32_t);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size) {
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+		ring->cq_ring_size = 0;
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	void* sq_ring = mmap((void*)0, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	ring->sq_ring = (u8_t*)sq_ring;
+	ring->cq_ring = ring->sq_ring;
+
+	if (ring->cq_ring_size > 0) {
+		void* cq_ring = mmap((void*)0, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED) {
+			munmap(sq_ring, ring->sq_ring_size);
+			close(fd);
+			return -1;
+		}
+		ring->cq_ring = (u8_t*)cq_ring;
+	}
+
+	void* sqes = mmap((void*)0, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		if (ring->cq_ring_size > 0) {
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		}
+		munmap(sq_ring, ring->sq_ring_size);
+		close(fd);
+		return -1;
+	}
+	ring->sqes = (struct io_uring_sqe*)sqes;
+
+	ring->sq_head = (u32_t*)(ring->sq_ring + params.sq_off.head);
+	ring->sq_tail = (u32_t*)(ring->sq_ring + params.sq_off.tail);
+	ring->sq_mask = (u32_t*)(ring->sq_ring + params.sq_off.ring_mask);
+	ring->sq_array = (u32_t*)(ring->sq_ring + params.sq_off.array);
+	ring->cq_head = (u32_t*)(ring->cq_ring + params.cq_off.head);
+	ring->cq_tail = (u32_t*)(ring->cq_ring + params.cq_off.tail);
+	ring->cq_mask = (u32_t*)(ring->cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(ring->cq_ring + params.cq_off.cqes);
+	ring->sq_entries = params.sq_entries;
+	ring->inflight = 0;
+	return 0;
+}
+
+static void posix_uring_close(posix_uring_t* ring) {
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring_size > 0) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+// 收取完成的请求，只完成了一部分时同步读写剩余部分
+static xfat_err_t posix_uring_reap(struct _xdisk_t* disk, posix_uring_t* ring, u8_t wait) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+
+	while (ring->inflight > 0) {
+		u32_t head = *ring->cq_head;
+		if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			if (!wait) {
+				break;
+			}
+			if ((syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, (void*)0, 0) < 0) && (errno != EINTR)) {
+				return FS_ERR_IO;
+			}
+			continue;
+		}
+
+		struct io_uring_cqe* cqe = ring->cqes + (head & *ring->cq_mask);
+		xdisk_io_t* io = (xdisk_io_t*)(uintptr_t)cqe->user_data;
+		size_t size = (size_t)io->count * disk->sector_size;
+		if (cqe->res < 0) {
+			io->err = FS_ERR_IO;
+		}
+		else if ((size_t)cqe->res < size) {
+			size_t done = (size_t)cqe->res;
+			io->err = (io->iov_count > 0) ? posix_disk_rwv(disk, io->iov, io->iov_count, io->start_sector, done, io->is_write) :
+				posix_disk_io(posix_disk->fd, io->buffer + done, size - done,
+					(off_t)xdisk_sector_offset(disk, io->start_sector) + (off_t)done, io->is_write);
+		}
+
+		__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+		ring->inflight--;
+	}
+
+	return FS_ERR_OK;
+}
+
+static xfat_err_t posix_uring_submit(struct _xdisk_t* disk, posix_uring_t* ring, xdisk_io_t* io) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+
+	// 在途请求不超过提交队列深度，完成队列就不会溢出
+	while (ring->inflight >= ring->sq_entries) {
+		xfat_err_t err = posix_uring_reap(disk, ring, 1);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	// 段数过多的请求直接同步完成
+	if (io->iov_count > POSIX_DISK_IOV_MAX) {
+		io->err = posix_disk_rwv(disk, io->iov, io->iov_count, io->start_sector, 0, io->is_write);
+		return FS_ERR_OK;
+	}
+
+	u32_t tail = *ring->sq_tail;
+	u32_t index = tail & *ring->sq_mask;
+	struct io_uring_sqe* sqe = ring->sqes + index;
+	struct iovec sys_iov[POSIX_DISK_IOV_MAX];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = posix_disk->fd;
+	if (io->iov_count > 0) {
+		for (u32_t i = 0; i < io->iov_count; i++) {
+			sys_iov[i].iov_base = io->iov[i].buffer;
+			sys_iov[i].iov_len = io->iov[i].size;
+		}
+		sqe->opcode = io->is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->addr = (u64_t)(uintptr_t)sys_iov;
+		sqe->len = io->iov_count;
+	}
+	else {
+		sqe->opcode = io->is_write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->addr = (u64_t)(uintptr_t)io->buffer;
+		sqe->len = io->count * disk->sector_size;
+	}
+	sqe->off = xdisk_sector_offset(disk, io->start_sector);
+	sqe->user_data = (u64_t)(uintptr_t)io;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	long ret;
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, (void*)0, 0);
+	} while ((ret < 0) && (errno == EINTR));
+
+	// 内核只在io_uring_enter中读取提交队列，失败时可以撤回
+	if (ret < 1) {
+		__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+		return FS_ERR_IO;
+	}
+
+	ring->inflight++;
+	return FS_ERR_OK;
+}
+#endif
+
+static void* posix_worker_main(void* arg) {
+	struct _xdisk_t* disk = (struct _xdisk_t*)arg;
+	posix_workers_t* workers = &((posix_disk_t*)disk->data)->workers;
+
+	pthread_mutex_lock(&workers->lock);
+	for (;;) {
+		while ((workers->head == (xdisk_io_t*)0) && !workers->quit) {
+			pthread_cond_wait(&workers->cond, &workers->lock);
+		}
+		if (workers->head == (xdisk_io_t*)0) {
+			break;
+		}
+
+		xdisk_io_t* io = workers->head;
+		workers->head = io->next;
+		if (workers->head == (xdisk_io_t*)0) {
+			workers->tail = (xdisk_io_t*)0;
+		}
+		pthread_mutex_unlock(&workers->lock);
+
+		io->err = (io->iov_count > 0) ? posix_disk_rwv(disk, io->iov, io->iov_count, io->start_sector, 0, io->is_write) :
+			posix_disk_rw(disk, io->buffer, io->start_sector, io->count, io->is_write);
+
+		pthread_mutex_lock(&workers->lock);
+		workers->inflight--;
+		pthread_cond_broadcast(&workers->done_cond);
+	}
+	pthread_mutex_unlock(&workers->lock);
+	return (void*)0;
+}
+
+static int posix_workers_init(struct _xdisk_t* disk, posix_workers_t* workers) {
+	workers->thread_count = 0;
+	workers->head = workers->tail = (xdisk_io_t*)0;
+	workers->inflight = 0;
+	workers->quit = 0;
+	pthread_mutex_init(&workers->lock, (pthread_mutexattr_t*)0);
+	pthread_cond_init(&workers->cond, (pthread_condattr_t*)0);
+	pthread_cond_init(&workers->done_cond, (pthread_condattr_t*)0);
+
+	while (workers->thread_count < POSIX_DISK_WORKERS) {
+		if (pthread_create(workers->threads + workers->thread_count, (pthread_attr_t*)0, posix_worker_main, disk) != 0) {
+			break;
+		}
+		workers->thread_count++;
+	}
+
+	if (workers->thread_count == 0) {
+		pthread_cond_destroy(&workers->done_cond);
+		pthread_cond_destroy(&workers->cond);
+		pthread_mutex_destroy(&workers->lock);
+		return -1;
+	}
+	return 0;
+}
+
+static void posix_workers_close(posix_workers_t* workers) {
+	pthread_mutex_lock(&workers->lock);
+	workers->quit = 1;
+	pthread_cond_broadcast(&workers->cond);
+	pthread_mutex_unlock(&workers->lock);
+
+	for (u32_t i = 0; i < workers->thread_count; i++) {
+		pthread_join(workers->threads[i], (void**)0);
+	}
+	pthread_cond_destroy(&workers->done_cond);
+	pthread_cond_destroy(&workers->cond);
+	pthread_mutex_destroy(&workers->lock);
+}
+
+/**
+ * 首次提交时选择异步方式：优先io_uring，不可用时改用工作线程执行pread/pwrite。
+ * O_DIRECT下io_uring要求缓冲区对齐，而缓存池的缓冲区一般不对齐，因此直接用工作线程经对齐的中转缓冲读写
+ */
+static void posix_async_init(struct _xdisk_t* disk) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+
+#ifdef POSIX_DISK_URING
+	if (!posix_disk->direct && (posix_uring_init(&posix_disk->uring) == 0)) {
+		posix_disk->async = POSIX_ASYNC_URING;
+		return;
+	}
+#endif
+
+	posix_disk->async = (posix_workers_init(disk, &posix_disk->workers) == 0) ? POSIX_ASYNC_THREAD : POSIX_ASYNC_SYNC;
+}
+
+static xfat_err_t posix_hw_submit(struct _xdisk_t* disk, xdisk_io_t* io) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+	if (posix_disk->async == POSIX_ASYNC_NONE) {
+		posix_async_init(disk);
+	}
+
+	switch (posix_disk->async) {
+#ifdef POSIX_DISK_URING
+	case POSIX_ASYNC_URING:
+		return posix_uring_submit(disk, &posix_disk->uring, io);
+#endif
+	case POSIX_ASYNC_THREAD: {
+		posix_workers_t* workers = &posix_disk->workers;
+		io->next = (xdisk_io_t*)0;
+		pthread_mutex_lock(&workers->lock);
+		if (workers->tail) {
+			workers->tail->next = io;
+		}
+		else {
+			workers->head = io;
+		}
+		workers->tail = io;
+		workers->inflight++;
+		pthread_cond_signal(&workers->cond);
+		pthread_mutex_unlock(&workers->lock);
+		return FS_ERR_OK;
+	}
+	default:
+		io->err = (io->iov_count > 0) ? posix_disk_rwv(disk, io->iov, io->iov_count, io->start_sector, 0, io->is_write) :
+			posix_disk_rw(disk, io->buffer, io->start_sector, io->count, io->is_write);
+		return io->err;
+	}
+}
+
+static xfat_err_t posix_hw_poll(struct _xdisk_t* disk, u8_t wait) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+
+	switch (posix_disk->async) {
+#ifdef POSIX_DISK_URING
+	case POSIX_ASYNC_URING: {
+		xfat_err_t err = posix_uring_reap(disk, &posix_disk->uring, wait);
+		return (err < 0) ? err : (xfat_err_t)posix_disk->uring.inflight;
+	}
+#endif
+	case POSIX_ASYNC_THREAD: {
+		posix_workers_t* workers = &posix_disk->workers;
+		pthread_mutex_lock(&workers->lock);
+		while (wait && (workers->inflight > 0)) {
+			pthread_cond_wait(&workers->done_cond, &workers->lock);
+		}
+		u32_t inflight = workers->inflight;
+		pthread_mutex_unlock(&workers->lock);
+		return (xfat_err_t)inflight;
+	}
+	default:
+		return 0;
+	}
+}
+
+// 关闭前等待在途请求完成，再释放io_uring或结束工作线程
+static void posix_async_close(struct _xdisk_t* disk) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+	posix_hw_poll(disk, 1);
+
+	switch (posix_disk->async) {
+#ifdef POSIX_DISK_URING
+	case POSIX_ASYNC_URING:
+		posix_uring_close(&posix_disk->uring);
+		break;
+#endif
+	case POSIX_ASYNC_THREAD:
+		posix_workers_close(&posix_disk->workers);
+		break;
+	default:
+		break;
+	}
+}
+
+static xfat_err_t posix_hw_readv(struct _xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector) {
+	xfat_err_t err = posix_disk_rwv(disk, iov, iov_count, start_sector, 0, 0);
+	if (err < 0) {
+		printf("read disk failed: sector: %u, iov: %u, reason: %s\n", start_sector, iov_count, strerror(errno));
+	}
+	return err;
+}
+
+static xfat_err_t posix_hw_writev(struct _xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector) {
+	xfat_err_t err = posix_disk_rwv(disk, iov, iov_count, start_sector, 0, 1);
+	if (err < 0) {
+		printf("write disk failed: sector: %u, iov: %u, reason: %s\n", start_sector, iov_count, strerror(errno));
+	}
+	return err;
+}
+
+static u8_t* posix_hw_map_sector(struct _xdisk_t* disk, u32_t start_sector, u32_t count) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+	u64_t end = xdisk_sector_offset(disk, (u64_t)start_sector + count);
+	if ((posix_disk->map == (u8_t*)0) || (end > posix_disk->map_size)) {
+		return (u8_t*)0;
+	}
+	return posix_disk->map + (size_t)xdisk_sector_offset(disk, start_sector);
+}
+
+// msync要求起始地址按页对齐，向前扩展到页边界
+static xfat_err_t posix_hw_sync_sector(struct _xdisk_t* disk, u32_t start_sector, u32_t count) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+	if (posix_disk->map == (u8_t*)0) {
+		return FS_ERR_OK;
+	}
+
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	u64_t start = xdisk_sector_offset(disk, start_sector);
+	u64_t end = xdisk_sector_offset(disk, (u64_t)start_sector + count);
+	if (end > posix_disk->map_size) {
+		end = posix_disk->map_size;
+	}
+	if (start >= end) {
+		return FS_ERR_OK;
+	}
+
+	start -= start % page_size;
+	if (msync(posix_disk->map + start, (size_t)(end - start), MS_SYNC) < 0) {
+		printf("sync disk failed: sector: %u, count: %u, reason: %s\n", start_sector, count, strerror(errno));
+		return FS_ERR_IO;
+	}
+	return FS_ERR_OK;
+}
+
+/**
+ * 释放扇区所占的存储：映像文件打洞，之后读出全0；块设备下发BLKDISCARD。系统不支持时忽略
+ */
+static xfat_err_t posix_hw_discard(struct _xdisk_t* disk, u32_t start_sector, u32_t count) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+	u64_t range[2] = { xdisk_sector_offset(disk, start_sector), xdisk_sector_offset(disk, count) };
+	int ret = 0;
+
+	// 在途的异步写晚于打洞完成会把数据写回
+	xfat_err_t err = posix_hw_poll(disk, 1);
+	if (err < 0) {
+		return err;
+	}
+
+#ifdef BLKDISCARD
+	if (posix_disk->block_dev) {
+		ret = ioctl(posix_disk->fd, BLKDISCARD, range);
+	}
+#endif
+#ifdef FALLOC_FL_PUNCH_HOLE
+	if (!posix_disk->block_dev) {
+		ret = fallocate(posix_disk->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)range[0], (off_t)range[1]);
+	}
+#endif
+	if ((ret < 0) && (errno != EOPNOTSUPP) && (errno != ENOTTY) && (errno != ENOSYS)) {
+		printf("discard disk failed: sector: %u, count: %u, reason: %s\n", start_sector, count, strerror(errno));
+		return FS_ERR_IO;
+	}
+	return FS_ERR_OK;
+}
+
+/**
+ * 扇区清0：映像文件标记为全0区域，块设备下发BLKZEROOUT，均不必传输数据。系统不支持时由上层写入全0
+ */
+static xfat_err_t posix_hw_write_zeroes(struct _xdisk_t* disk, u32_t start_sector, u32_t count) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+	u64_t range[2] = { xdisk_sector_offset(disk, start_sector), xdisk_sector_offset(disk, count) };
+	int ret = -1;
+
+	xfat_err_t err = posix_hw_poll(disk, 1);
+	if (err < 0) {
+		return err;
+	}
+
+	errno = EOPNOTSUPP;
+#ifdef BLKZEROOUT
+	if (posix_disk->block_dev) {
+		ret = ioctl(posix_disk->fd, BLKZEROOUT, range);
+	}
+#endif
+#ifdef FALLOC_FL_ZERO_RANGE
+	if (!posix_disk->block_dev) {
+		ret = fallocate(posix_disk->fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, (off_t)range[0], (off_t)range[1]);
+	}
+#endif
+	if (ret < 0) {
+		if ((errno == EOPNOTSUPP) || (errno == ENOTTY) || (errno == ENOSYS) || (errno == EINVAL)) {
+			return FS_ERR_NONE;
+		}
+		printf("zero disk failed: sector: %u, count: %u, reason: %s\n", start_sector, count, strerror(errno));
+		return FS_ERR_IO;
+	}
+	return FS_ERR_OK;
+}
+
+// 持久化屏障：先等待在途的异步请求，映射时同步整个映射，否则只同步数据及必要的元数据
+static xfat_err_t posix_hw_sync(struct _xdisk_t* disk) {
+	posix_disk_t* posix_disk = (posix_disk_t*)disk->data;
+	xfat_err_t err = posix_hw_poll(disk, 1);
+	if (err < 0) {
+		return err;
+	}
+
+	if (posix_disk->map) {
+		if (msync(posix_disk->map, posix_disk->map_size, MS_SYNC) < 0) {
+			printf("sync disk failed, reason: %s\n", strerror(errno));
+			return FS_ERR_IO;
+		}
+		return FS_ERR_OK;
+	}
+
+#ifdef __linux__
+	int ret = fdatasync(posix_disk->fd);
+#else
+	int ret = fsync(posix_disk->fd);
+#endif
+	if (ret < 0) {
+		printf("sync disk failed, reason: %s\n", strerror(errno));
+		return FS_ERR_IO;
+	}
+	return FS_ERR_OK;
+}
+
+static xfat_err_t posix_hw_curr_time(struct _xdisk_t* disk, struct _xfile_time_t* timeinfo) {
+	time_t raw_time;
+	struct tm local_time;
+
+	(void)disk;
+	time(&raw_time);
+	localtime_r(&raw_time, &local_time);
+
+	timeinfo->year = local_time.tm_year + 1900;
+	timeinfo->month = local_time.tm_mon + 1;
+	timeinfo->day = local_time.tm_mday;
+	timeinfo->hour = local_time.tm_hour;
+	timeinfo->minute = local_time.tm_min;
+	timeinfo->second = local_time.tm_sec;
+
+	return FS_ERR_OK;
+}
+
+xdisk_driver_t posix_disk_driver = {
+	.open = posix_hw_open,
+	.close = posix_hw_close,
+	.curr_time = posix_hw_curr_time,
+	.read_sector = posix_hw_read_sector,
+	.write_sector = posix_hw_write_sector,
+	.readv = posix_hw_readv,
+	.writev = posix_hw_writev,
+	.sync = posix_hw_sync,
+	.discard = posix_hw_discard,
+	.write_zeroes = posix_hw_write_zeroes,
+	.submit = posix_hw_submit,
+	.poll = posix_hw_poll,
+};
+
+// 以O_DIRECT打开的版本，适用于不希望经过系统页缓存的大映像
+xdisk_driver_t posix_direct_disk_driver = {
+	.open = posix_hw_open_direct,
+	.close = posix_hw_close,
+	.curr_time = posix_hw_curr_time,
+	.read_sector = posix_hw_read_sector,
+	.write_sector = posix_hw_write_sector,
+	.readv = posix_hw_readv,
+	.writev = posix_hw_writev,
+	.sync = posix_hw_sync,
+	.discard = posix_hw_discard,
+	.write_zeroes = posix_hw_write_zeroes,
+	.submit = posix_hw_submit,
+	.poll = posix_hw_poll,
+};
+
+// 将整个映像映射到内存，配合缓存池的直通模式，缓存直接指向映射，省去拷贝
+xdisk_driver_t posix_mmap_disk_driver = {
+	.open = posix_hw_open_mmap,
+	.close = posix_hw_close,
+	.curr_time = posix_hw_curr_time,
+	.read_sector = posix_hw_read_sector,
+	.write_sector = posix_hw_write_sector,
+	.readv = posix_hw_readv,
+	.writev = posix_hw_writev,
+	.sync = posix_hw_sync,
+	.discard = posix_hw_discard,
+	.write_zeroes = posix_hw_write_zeroes,
+	.map_sector = posix_hw_map_sector,
+	.sync_sector = posix_hw_sync_sector,
+};
+
+#endif
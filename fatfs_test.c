@@ -3,8 +3,7 @@
 #include <stdlib.h>
 #include "xdisk.h"
 #include "xfat.h"
-
-extern xdisk_driver_t vdisk_driver;
+#include "driver.h"
 
 const char* disk_path_test = "disk_test.img";
 const char* disk_path = "disk.img";
@@ -12,13 +11,13 @@ static u32_t write_buffer[160 * 1024];
 static u32_t read_buffer[160 * 1024];
 
 
-// ̻д
+// 磁盘缓存读写测试
 int disk_buf_test(xdisk_t* disk, int buf_nr) {
 	xfat_err_t err;
 	xfat_buf_t* disk_buf;
 	int i;
 
-	// дԣȫʹû
+	// 连续读写测试，全部使用缓存
 	for (i = 0; i < buf_nr; i++) {
 		err = xfat_bpool_read_sector(&disk->obj, &disk_buf, i);
 		if (err < 0) return err;
@@ -62,13 +61,20 @@ int disk_io_test(void) {
 	memset(read_buffer, 0, sizeof(read_buffer));
 
 #define DISK_BUF_NR 3
-	static u8_t disk_buf[XFAT_BUF_SIZE(512, DISK_BUF_NR)];
+	static u8_t disk_buf[XFAT_BUF_SIZE(XDISK_SECTOR_SIZE_MAX, DISK_BUF_NR)];
 	err = xdisk_open(&disk_test, "vdisk_test", &vdisk_driver, (void*)disk_path_test, disk_buf, sizeof(disk_buf));
 	if (err) {
 		printf("open disk failed!\n");
 		return -1;
 	}
 
+	// 缓存按最大的扇区准备，打开后按实际扇区大小保留DISK_BUF_NR个
+	err = xfat_bpool_resize(&disk_test.obj, XFAT_BPOOL_PART_DATA, disk_buf, XFAT_BUF_SIZE(disk_test.sector_size, DISK_BUF_NR));
+	if (err) {
+		printf("resize disk buf failed!\n");
+		return -1;
+	}
+
 	err = xdisk_write_sector(&disk_test, (u8_t*)write_buffer, 0, 2);
 	if (err) {
 		printf("write disk failed!\n");
@@ -124,7 +130,7 @@ int disk_part_test(void) {
 		}
 
 		printf("no: %d, start: %d, count: %d, capacity: %.0f M\n", i, part.start_sector, part.total_sector,
-			part.total_sector * disk.sector_size / 1024 / 1024.0);
+			xdisk_part_size(&part) / 1024 / 1024.0);
 	}
 
 	printf("partition count: %d\n", count);
@@ -422,7 +428,7 @@ int dir_traverse_test(void) {
 
 int file_read_and_check(const char* path, xfile_size_t elem_size, xfile_size_t e_count) {
 	xfile_t file;
-	static u8_t file_buf[XFAT_BUF_SIZE(512, 4)];
+	static u8_t file_buf[XFAT_BUF_SIZE(XDISK_SECTOR_SIZE_MAX, 4)];
 
 	xfat_err_t err = xfile_open(&file, path);
 	if (err != FS_ERR_OK) {
@@ -430,7 +436,7 @@ int file_read_and_check(const char* path, xfile_size_t elem_size, xfile_size_t e
 		return -1;
 	}
 
-	err = xfile_set_buf(&file, file_buf, sizeof(file_buf));
+	err = xfile_set_buf(&file, file_buf, XFAT_BUF_SIZE(disk.sector_size, 4));
 	if (err < 0) {
 		printf("set file buf failed!\n");
 		return err;
@@ -687,7 +693,7 @@ xfat_err_t fs_modify_file_test(void) {
 
 	sprintf(curr_path, "%s%s", dir_path, new_name);
 
-	// ޸ļʱ
+	// 修改文件时间
 	xfile_time_t timeinfo;
 	timeinfo.year = 2030;
 	timeinfo.month = 10;
@@ -725,7 +731,7 @@ xfat_err_t fs_modify_file_test(void) {
 		return err;
 	}
 
-	// бʾļʾ״̬
+	// 重命名后，列表显示所有文件，显示命名状态
 	err = xfile_open(&file, dir_path);
 	if (err < 0) {
 		printf("Open dir failed!\n");
@@ -1069,7 +1075,7 @@ xfat_err_t fs_format_test(void) {
 	}
 
 	xfat_fmt_ctrl_init(&ctrl);
-	ctrl.cluster_size = XFAT_CLUSTER_512B;
+	ctrl.cluster_size = (disk.sector_size > XFAT_CLUSTER_512B) ? XFAT_CLUSTER_4K : XFAT_CLUSTER_512B;
 	ctrl.vol_name = "XFAT DISK";
 
 	err = xfat_format(&fmt_part, &ctrl);
@@ -1081,114 +1087,1652 @@ xfat_err_t fs_format_test(void) {
 	return 0;
 }
 
-int main(void) {
-#define DISK_BUF_NR 3
-	static u8_t disk_buf[XFAT_BUF_SIZE(512, DISK_BUF_NR)];
-	static u8_t fat_buf[XFAT_BUF_SIZE(512, 4)];
+// 以下为往返测试：在新建的磁盘映像上写入，关闭磁盘后重新打开并挂载，读回比较，并重新统计空闲簇数
+const char* disk_path_rt = "disk_rt.img";
+#define RT_DISK_SIZE (64 * 1024 * 1024)
+#define RT_TAIL_SECTORS 8           // 分区之后保留的扇区，用于异步读写测试
+#define RT_DISK_BUF_NR 4
+
+xdisk_t rt_disk;
+xdisk_part_t rt_part;
+xfat_t rt_fat;
+xdisk_driver_t* rt_driver;
+static u8_t rt_disk_buf[XFAT_BUF_SIZE(XDISK_SECTOR_SIZE_MAX, RT_DISK_BUF_NR)];
+static u8_t rt_fat_buf[XFAT_BUF_SIZE(XDISK_SECTOR_SIZE_MAX, 4 + 4 + 16)];
+static u32_t rt_free_map[16 * 1024];
+static u8_t rt_delay_buf[16 * 1024];
+static xfile_extent_t rt_extents[16];
+
+#define RT_POOL_BUF_NR 16           // 缓存池测试时磁盘缓存池的大小
+static u8_t rt_pool_buf[XFAT_BUF_SIZE(XDISK_SECTOR_SIZE_MAX, RT_POOL_BUF_NR)];
+
+#define rt_cluster_count(size) (((size) + rt_fat.cluster_byte_size - 1) / rt_fat.cluster_byte_size)
+
+// 生成只有一个FAT32分区的空白映像，分区从1MB处开始，末尾保留RT_TAIL_SECTORS个扇区
+int create_disk_image(const char* path, u32_t sector_size) {
+	mbr_t mbr;
+	u32_t total_sectors = RT_DISK_SIZE / sector_size;
+
+	memset(&mbr, 0, sizeof(mbr));
+	mbr.part_info[0].system_id = FS_WIN95_FAT32_1;
+	mbr.part_info[0].relative_sectors = 1024 * 1024 / sector_size;
+	mbr.part_info[0].total_sectors = total_sectors - mbr.part_info[0].relative_sectors - RT_TAIL_SECTORS;
+	mbr.boot_sig[0] = 0x55;
+	mbr.boot_sig[1] = 0xAA;
+
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) {
+		printf("create disk image failed: %s\n", path);
+		return -1;
+	}
+	fwrite(&mbr, sizeof(mbr), 1, file);
+	fseek(file, RT_DISK_SIZE - 1, SEEK_SET);
+	fputc(0, file);
+	fclose(file);
+	return 0;
+}
 
-	for (int i = 0; i < sizeof(write_buffer) / sizeof(u32_t); i++) {
-		write_buffer[i] = i;
+int rt_mount(void) {
+	xfat_err_t err = xdisk_open(&rt_disk, "rt_disk", rt_driver, (void*)disk_path_rt, rt_disk_buf, sizeof(rt_disk_buf));
+	if (err < 0) {
+		printf("open disk failed!\n");
+		return err;
 	}
 
-	int err = disk_io_test();
-	if (err) {
+	err = xfat_bpool_resize(&rt_disk.obj, XFAT_BPOOL_PART_DATA, rt_disk_buf, XFAT_BUF_SIZE(rt_disk.sector_size, RT_DISK_BUF_NR));
+	if (err < 0) {
+		printf("resize disk buf failed!\n");
 		return err;
 	}
 
-	err = xdisk_open(&disk, "vdisk", &vdisk_driver, (void*)disk_path, disk_buf, sizeof(disk_buf));
-	if (err) {
-		printf("open disk failed!\n");
+	err = xdisk_get_part(&rt_disk, &rt_part, 0);
+	if (err < 0) {
+		printf("read partion failed!\n");
+		return err;
+	}
+
+	err = xfat_mount(&rt_fat, &rt_part, "rt");
+	if (err < 0) {
+		printf("mount failed!\n");
+		return err;
+	}
+
+	err = xfat_set_buf(&rt_fat, rt_fat_buf, XFAT_BUF_SIZE(rt_disk.sector_size, 4), XFAT_BUF_SIZE(rt_disk.sector_size, 4),
+		XFAT_BUF_SIZE(rt_disk.sector_size, 16));
+	if (err < 0) {
+		printf("set fat buf failed!\n");
+		return err;
+	}
+	return 0;
+}
+
+int rt_unmount(void) {
+	xfat_unmount(&rt_fat);
+
+	xfat_err_t err = xdisk_close(&rt_disk);
+	if (err < 0) {
+		printf("disk close failed\n");
+		return err;
+	}
+	return 0;
+}
+
+int rt_remount(void) {
+	int err = rt_unmount();
+	if (err < 0) {
+		return err;
+	}
+	return rt_mount();
+}
+
+// 扫描FAT表重新统计空闲簇，与挂载时读到的空闲簇数及预期值比较
+int rt_check_free(u32_t expect) {
+	u32_t free_count = rt_fat.cluster_total_free;
+
+	xfat_err_t err = xfat_set_free_map(&rt_fat, rt_free_map, sizeof(rt_free_map));
+	if (err < 0) {
+		printf("set free map failed!\n");
+		return err;
+	}
+	xfat_set_free_map(&rt_fat, (u32_t*)0, 0);
+
+	if ((free_count != expect) || (rt_fat.cluster_total_free != expect)) {
+		printf("free count error: fsinfo %u, fat %u, expect %u\n", free_count, rt_fat.cluster_total_free, expect);
 		return -1;
 	}
+	return 0;
+}
 
-	err = disk_part_test();
-	if (err) {
+// 写入write_buffer中offset开始的size字节，每次写入elem_size字节
+int rt_file_write(xfile_t* file, u32_t offset, u32_t size, u32_t elem_size) {
+	u8_t* data = (u8_t*)write_buffer + offset;
+
+	while (size > 0) {
+		u32_t curr_size = (size > elem_size) ? elem_size : size;
+		if (xfile_write(data, curr_size, 1, file) != 1) {
+			printf("write file failed!\n");
+			return -1;
+		}
+		data += curr_size;
+		size -= curr_size;
+	}
+	return 0;
+}
+
+int rt_create_file(const char* path, u32_t size, u32_t elem_size) {
+	xfile_t file;
+
+	xfat_err_t err = xfile_mkfile(path);
+	if (err < 0) {
+		printf("create file failed: %s\n", path);
 		return err;
 	}
 
-	err = xdisk_get_part(&disk, &disk_part, 1);
+	err = xfile_open(&file, path);
 	if (err < 0) {
-		printf("read partion failed!\n");
+		printf("open file failed: %s\n", path);
+		return err;
+	}
+
+	err = rt_file_write(&file, 0, size, elem_size);
+	if (err < 0) {
+		return err;
+	}
+	return xfile_close(&file);
+}
+
+// 按不对齐的大小顺序读回文件，与write_buffer比较
+int rt_file_check(const char* path, u32_t size) {
+	xfile_t file;
+	xfile_size_t file_size;
+
+	xfat_err_t err = xfile_open(&file, path);
+	if (err < 0) {
+		printf("open file failed: %s\n", path);
+		return err;
+	}
+
+	xfile_size(&file, &file_size);
+	if (file_size != size) {
+		printf("file size error: %s\n", path);
 		return -1;
 	}
 
-	err = xfat_init();
+	memset(read_buffer, 0, sizeof(read_buffer));
+	for (u32_t offset = 0; offset < size; offset += 3000) {
+		u32_t curr_size = (size - offset > 3000) ? 3000 : size - offset;
+		if (xfile_read((u8_t*)read_buffer + offset, curr_size, 1, &file) != 1) {
+			printf("read file failed: %s\n", path);
+			return -1;
+		}
+	}
+
+	if (memcmp(read_buffer, write_buffer, size) != 0) {
+		printf("content different: %s\n", path);
+		return -1;
+	}
+	return xfile_close(&file);
+}
+
+// 重新划分同一块缓存：各分区都有脏缓存时扩大FAT分区、缩小其它分区，之后读回比较
+int rt_resplit_test(void) {
+	u32_t sector_size = rt_disk.sector_size;
+	u32_t free_count = rt_fat.cluster_total_free;
+	char path[64];
+
+	xfat_err_t err = xfat_set_buf(&rt_fat, rt_fat_buf, XFAT_BUF_SIZE(sector_size, 1), XFAT_BUF_SIZE(sector_size, 2),
+		XFAT_BUF_SIZE(sector_size, 16));
 	if (err < 0) {
+		printf("set fat buf failed!\n");
 		return err;
 	}
 
-	err = xfat_mount(&xfat, &disk_part, "mp0");
+	// 镜像表延迟同步时FAT表的修改才留在缓存中
+	err = xfat_set_fat_mirror_defer(&rt_fat, 1);
 	if (err < 0) {
-		printf("open fat failed!\n");
+		return err;
+	}
+
+	err = xfile_mkdir("/rt/split");
+	if (err < 0) {
+		return err;
+	}
+	for (int i = 0; i < 4; i++) {
+		sprintf(path, "/rt/split/f%d.bin", i);
+		err = rt_create_file(path, 3000 + i, 1000);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	if (!rt_fat.fat_bpool.dirty_count || !rt_fat.dir_bpool.dirty_count || !rt_fat.bpool.dirty_count) {
+		printf("no dirty buffer in some partition!\n");
 		return -1;
 	}
 
-	err = xfat_set_buf(&xfat, fat_buf, sizeof(fat_buf));
+	err = xfat_set_buf(&rt_fat, rt_fat_buf, XFAT_BUF_SIZE(sector_size, 20), XFAT_BUF_SIZE(sector_size, 2),
+		XFAT_BUF_SIZE(sector_size, 2));
+	if (err < 0) {
+		printf("resplit fat buf failed!\n");
+		return err;
+	}
+
+	for (int i = 0; i < 4; i++) {
+		sprintf(path, "/rt/split/f%d.bin", i);
+		err = rt_file_check(path, 3000 + i);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_check_free(free_count - 1 - 4 * rt_cluster_count(3000));
+	if (err < 0) {
+		return err;
+	}
+	for (int i = 0; i < 4; i++) {
+		sprintf(path, "/rt/split/f%d.bin", i);
+		err = rt_file_check(path, 3000 + i);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	printf("resplit test ok!\n");
+	return 0;
+}
+
+// 固定缓存：目录分区只有2个缓存时只能固定1个，被固定的缓存在其它读取后仍保留原内容；
+// 之后在这样小的目录缓存下建立、删除大量文件，重新挂载后检查
+int rt_pin_test(void) {
+	u32_t sector_size = rt_disk.sector_size;
+	u32_t sector = rt_fat.fat_start_sector + rt_fat.fat_tbl_nr * rt_fat.fat_tbl_sectors + 100;
+	u32_t free_count = rt_fat.cluster_total_free;
+	xfat_buf_t* pinned;
+	xfat_buf_t* buf;
+	xfile_t dir;
+	xfileinfo_t info;
+	char path[64];
+
+	xfat_err_t err = xfat_set_buf(&rt_fat, rt_fat_buf, XFAT_BUF_SIZE(sector_size, 4), XFAT_BUF_SIZE(sector_size, 2),
+		XFAT_BUF_SIZE(sector_size, 16));
 	if (err < 0) {
 		printf("set fat buf failed!\n");
 		return err;
 	}
 
-	err = fat_dir_test();
-	if (err) {
+	err = xfat_bpool_read_sector(&rt_fat.obj, &pinned, sector);
+	if (err < 0) {
+		return err;
+	}
+	err = xfat_bpool_pin(&rt_fat.obj, pinned);
+	if (err < 0) {
+		printf("pin failed!\n");
+		return err;
+	}
+	memcpy(pinned->buf, write_buffer, sector_size);
+	err = xfat_bpool_write_sector(&rt_fat.obj, pinned, 0);
+	if (err < 0) {
 		return err;
 	}
 
-	err = fat_file_test();
-	if (err) {
+	// 只剩1个可替换的缓存，不能再固定
+	err = xfat_bpool_read_sector(&rt_fat.obj, &buf, sector + 1);
+	if (err < 0) {
 		return err;
 	}
+	if (xfat_bpool_pin(&rt_fat.obj, buf) != FS_ERR_NO_BUFFER) {
+		printf("pin should fail when pool exhausted!\n");
+		return -1;
+	}
 
-	err = fs_open_test();
-	if (err) {
+	for (u32_t i = 1; i < 8; i++) {
+		err = xfat_bpool_read_sector(&rt_fat.obj, &buf, sector + i);
+		if (err < 0) {
+			return err;
+		}
+	}
+	if (memcmp(pinned->buf, write_buffer, sector_size)) {
+		printf("pinned buffer replaced!\n");
+		return -1;
+	}
+
+	err = xfat_bpool_read_sector(&rt_fat.obj, &buf, sector);
+	if (err < 0) {
 		return err;
 	}
+	if (buf != pinned) {
+		printf("pinned buffer not found!\n");
+		return -1;
+	}
+	xfat_bpool_unpin(&rt_fat.obj, pinned);
 
-	err = dir_traverse_test();
-	if (err) {
+	err = xfat_bpool_read_sector(&rt_fat.obj, &buf, sector + 1);
+	if (err < 0) {
 		return err;
 	}
+	err = xfat_bpool_pin(&rt_fat.obj, buf);
+	if (err < 0) {
+		printf("pin after unpin failed!\n");
+		return err;
+	}
+	xfat_bpool_unpin(&rt_fat.obj, buf);
 
-	err = fs_read_test();
+	// 目录项跨越多个扇区时建立及删除文件
+	err = xfile_mkdir("/rt/pin");
 	if (err < 0) {
-		printf("read test failed\n");
+		return err;
+	}
+	for (int i = 0; i < 40; i++) {
+		sprintf(path, "/rt/pin/file%d.bin", i);
+		err = rt_create_file(path, 100 + i, 100);
+		if (err < 0) {
+			return err;
+		}
+	}
+	for (int i = 0; i < 40; i += 2) {
+		sprintf(path, "/rt/pin/file%d.bin", i);
+		err = xfile_rmfile(path);
+		if (err < 0) {
+			printf("rm file failed: %s\n", path);
+			return err;
+		}
+	}
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+
+	err = xfile_open(&dir, "/rt/pin");
+	if (err < 0) {
+		return err;
+	}
+	int file_count = 0;
+	err = xdir_first_file(&dir, &info);
+	while (err == FS_ERR_OK) {
+		if (info.type == FAT_FILE) {
+			file_count++;
+		}
+		err = xdir_next_file(&dir, &info);
+	}
+	xfile_close(&dir);
+	if (file_count != 20) {
+		printf("file count error: %d\n", file_count);
 		return -1;
 	}
 
-	err = fs_seek_test();
-	if (err) {
+	for (int i = 1; i < 40; i += 2) {
+		sprintf(path, "/rt/pin/file%d.bin", i);
+		err = rt_file_check(path, 100 + i);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	// 40个文件及.、..目录项，删除的目录项不回收
+	u32_t dir_clusters = rt_cluster_count((40 + 2) * sizeof(diritem_t));
+	err = rt_check_free(free_count - dir_clusters - 20);
+	if (err < 0) {
 		return err;
 	}
 
-	err = fs_modify_file_test();
-	if (err) {
+	printf("pin test ok!\n");
+	return 0;
+}
+
+// 比较磁盘上的主FAT表与镜像表，same为0时要求两者不同
+int rt_compare_fat_mirror(int same) {
+	u32_t sector_size = rt_disk.sector_size;
+	u32_t max_count = sizeof(read_buffer) / 2 / sector_size;
+	u8_t* mirror = (u8_t*)read_buffer + max_count * sector_size;
+	int diff = 0;
+
+	for (u32_t sector = 0; sector < rt_fat.fat_tbl_sectors; sector += max_count) {
+		u32_t count = rt_fat.fat_tbl_sectors - sector;
+		if (count > max_count) {
+			count = max_count;
+		}
+
+		xfat_err_t err = xdisk_read_sector(&rt_disk, (u8_t*)read_buffer, rt_fat.fat_start_sector + sector, count);
+		if (err < 0) {
+			return err;
+		}
+		err = xdisk_read_sector(&rt_disk, mirror, rt_fat.fat_start_sector + rt_fat.fat_tbl_sectors + sector, count);
+		if (err < 0) {
+			return err;
+		}
+		if (memcmp(read_buffer, mirror, count * sector_size)) {
+			diff = 1;
+		}
+	}
+
+	if (diff == same) {
+		printf(same ? "fat mirror different!\n" : "fat mirror not deferred!\n");
+		return -1;
+	}
+	return 0;
+}
+
+// 镜像表延迟同步：修改FAT表后回写主表，镜像表在xfat_sync前保持不变，之后与主表一致
+int rt_mirror_test(void) {
+	u32_t size = 20 * 1024;
+	u32_t free_count = rt_fat.cluster_total_free;
+
+	if (rt_fat.fat_tbl_nr < 2) {
+		printf("no fat mirror, skip mirror test\n");
+		return 0;
+	}
+
+	xfat_err_t err = xfat_set_fat_mirror_defer(&rt_fat, 1);
+	if (err < 0) {
 		return err;
 	}
 
-	err = fs_write_test();
-	if (err) {
+	err = rt_create_file("/rt/mirror.bin", size, 1000);
+	if (err < 0) {
 		return err;
 	}
 
-	err = fs_create_test();
-	if (err) {
+	err = xfat_bpool_flush(&rt_fat.obj);
+	if (err < 0) {
+		return err;
+	}
+	err = rt_compare_fat_mirror(0);
+	if (err < 0) {
 		return err;
 	}
 
-	err = fs_rmdir_tree_test();
-	if (err) {
+	err = xfat_sync(&rt_fat);
+	if (err < 0) {
+		return err;
+	}
+	err = rt_compare_fat_mirror(1);
+	if (err < 0) {
 		return err;
 	}
 
-	err = fs_resize_test();
-	if (err) {
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+	err = rt_compare_fat_mirror(1);
+	if (err < 0) {
 		return err;
 	}
 
-	err = fs_format_test();
+	err = rt_check_free(free_count - rt_cluster_count(size));
+	if (err < 0) {
+		return err;
+	}
+	err = rt_file_check("/rt/mirror.bin", size);
+	if (err < 0) {
+		return err;
+	}
+
+	printf("mirror test ok!\n");
+	return 0;
+}
+
+// 空闲簇位图：启用位图分配及释放簇，重新挂载后FAT表中的空闲簇数应一致
+int rt_free_map_test(void) {
+	u32_t size = 300 * 1024;
+
+	xfat_err_t err = xfat_set_free_map(&rt_fat, rt_free_map, sizeof(rt_free_map));
+	if (err < 0) {
+		printf("set free map failed!\n");
+		return err;
+	}
+
+	u32_t free_count = rt_fat.cluster_total_free;
+	err = rt_create_file("/rt/map_tmp.bin", 100 * 1024, 4096);
+	if (err < 0) {
+		return err;
+	}
+	err = rt_create_file("/rt/map.bin", size, 4096);
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_rmfile("/rt/map_tmp.bin");
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_check_free(free_count - rt_cluster_count(size));
+	if (err < 0) {
+		return err;
+	}
+	err = rt_file_check("/rt/map.bin", size);
+	if (err < 0) {
+		return err;
+	}
+
+	printf("free map test ok!\n");
+	return 0;
+}
+
+// 连续簇分配：一次写入的簇应物理连续
+int rt_alloc_run_test(void) {
+	u32_t size = 256 * 1024;
+	u32_t free_count = rt_fat.cluster_total_free;
+	xfile_t file;
+
+	xfat_err_t err = rt_create_file("/rt/run.bin", size, size);
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+
+	err = xfile_open(&file, "/rt/run.bin");
+	if (err < 0) {
+		return err;
+	}
+
+	u32_t cluster = file.start_cluster, count = 0;
+	while (is_cluster_valid(cluster)) {
+		u32_t next_cluster;
+		err = get_next_cluster(&rt_fat, cluster, &next_cluster);
+		if (err < 0) {
+			return err;
+		}
+		if (is_cluster_valid(next_cluster) && (next_cluster != cluster + 1)) {
+			printf("cluster not contiguous: %u -> %u\n", cluster, next_cluster);
+			return -1;
+		}
+		cluster = next_cluster;
+		count++;
+	}
+	xfile_close(&file);
+
+	if (count != rt_cluster_count(size)) {
+		printf("cluster count error!\n");
+		return -1;
+	}
+
+	err = rt_check_free(free_count - count);
+	if (err < 0) {
+		return err;
+	}
+	err = rt_file_check("/rt/run.bin", size);
+	if (err < 0) {
+		return err;
+	}
+
+	printf("alloc run test ok!\n");
+	return 0;
+}
+
+// 预分配：写入使用预分配的簇，显式释放及关闭文件时释放多余的部分
+int rt_fallocate_test(void) {
+	u32_t cluster_size = rt_fat.cluster_byte_size;
+	u32_t size = 5 * cluster_size + 100;
+	u32_t free_count = rt_fat.cluster_total_free;
+	xfile_t file;
+
+	xfat_err_t err = xfile_mkfile("/rt/falloc.bin");
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_open(&file, "/rt/falloc.bin");
+	if (err < 0) {
+		return err;
+	}
+
+	err = xfile_fallocate(&file, 16 * cluster_size, 0);
+	if (err < 0) {
+		printf("fallocate failed!\n");
+		return err;
+	}
+	if (rt_fat.cluster_total_free != free_count - 16) {
+		printf("fallocate free count error!\n");
+		return -1;
+	}
+
+	err = rt_file_write(&file, 0, size, 1000);
+	if (err < 0) {
+		return err;
+	}
+	if (rt_fat.cluster_total_free != free_count - 16) {
+		printf("write not use reserved clusters!\n");
+		return -1;
+	}
+
+	err = xfile_fallocate(&file, 8 * cluster_size, XFILE_FALLOC_RELEASE);
+	if (err < 0) {
+		printf("fallocate release failed!\n");
+		return err;
+	}
+	if (rt_fat.cluster_total_free != free_count - 8) {
+		printf("release free count error!\n");
+		return -1;
+	}
+	xfile_close(&file);
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_check_free(free_count - rt_cluster_count(size));
+	if (err < 0) {
+		return err;
+	}
+	err = rt_file_check("/rt/falloc.bin", size);
+	if (err < 0) {
+		return err;
+	}
+
+	printf("fallocate test ok!\n");
+	return 0;
+}
+
+// 延迟分配：小块追加写入先暂存，关闭时才分配簇并写入
+int rt_delalloc_test(void) {
+	u32_t size = 200 * 1024 + 123;
+	u32_t free_count = rt_fat.cluster_total_free;
+	xfile_t file;
+
+	xfat_err_t err = xfile_mkfile("/rt/delalloc.bin");
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_open(&file, "/rt/delalloc.bin");
+	if (err < 0) {
+		return err;
+	}
+
+	err = xfile_set_delalloc(&file, rt_delay_buf, sizeof(rt_delay_buf));
+	if (err < 0) {
+		printf("set delalloc failed!\n");
+		return err;
+	}
+
+	err = rt_file_write(&file, 0, size, 1000);
+	if (err < 0) {
+		return err;
+	}
+	xfile_close(&file);
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_check_free(free_count - rt_cluster_count(size));
+	if (err < 0) {
+		return err;
+	}
+	err = rt_file_check("/rt/delalloc.bin", size);
+	if (err < 0) {
+		return err;
+	}
+
+	printf("delalloc test ok!\n");
+	return 0;
+}
+
+// 延迟分配遇到磁盘满：回写失败时暂存的数据保留在缓冲区中，释放空间后可重试写入
+int rt_delalloc_full_test(void) {
+	u32_t cluster_size = rt_fat.cluster_byte_size;
+	u32_t size = 3 * cluster_size + 100;
+	u32_t free_count = rt_fat.cluster_total_free;
+	xfile_size_t file_size;
+	xfile_t file, hog;
+
+	xfat_err_t err = xfile_mkfile("/rt/hog.bin");
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_open(&hog, "/rt/hog.bin");
+	if (err < 0) {
+		return err;
+	}
+
+	// 只留下一个空闲簇
+	err = xfile_fallocate(&hog, (free_count - 1) * cluster_size, 0);
+	if ((err < 0) || (rt_fat.cluster_total_free != 1)) {
+		printf("fallocate hog failed!\n");
+		return -1;
+	}
+
+	err = xfile_mkfile("/rt/delfull.bin");
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_open(&file, "/rt/delfull.bin");
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_set_delalloc(&file, rt_delay_buf, sizeof(rt_delay_buf));
+	if (err < 0) {
+		return err;
+	}
+	err = rt_file_write(&file, 0, size, 1000);
+	if (err < 0) {
+		return err;
+	}
+
+	err = xfile_sync(&file);
+	if (err != FS_ERR_DISK_FULL) {
+		printf("sync not report disk full!\n");
+		return -1;
+	}
+	xfile_size(&file, &file_size);
+	if ((file_size != size) || (xfile_tell(&file) != size) || (rt_fat.cluster_total_free != 0)) {
+		printf("delay data lost after disk full!\n");
+		return -1;
+	}
+
+	err = xfile_fallocate(&hog, 0, XFILE_FALLOC_RELEASE);
+	if (err < 0) {
+		printf("release hog failed!\n");
+		return err;
+	}
+	xfile_close(&hog);
+
+	err = xfile_close(&file);
+	if (err < 0) {
+		printf("retry flush failed!\n");
+		return err;
+	}
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_check_free(free_count - rt_cluster_count(size));
+	if (err < 0) {
+		return err;
+	}
+	err = rt_file_check("/rt/delfull.bin", size);
+	if (err < 0) {
+		return err;
+	}
+
+	printf("delalloc disk full test ok!\n");
+	return 0;
+}
+
+// 区段映射：两个文件交替追加使簇链分成多段，映射缓冲区放不下全部区段，随机定位后读取比较
+int rt_extent_map_test(void) {
+	u32_t chunk_size = 2 * rt_fat.cluster_byte_size;
+	u32_t chunk_count = 40;
+	u32_t size = chunk_size * chunk_count;
+	u32_t free_count = rt_fat.cluster_total_free;
+	xfile_t file, other;
+
+	if (size > sizeof(write_buffer)) {
+		chunk_count = sizeof(write_buffer) / chunk_size;
+		size = chunk_size * chunk_count;
+	}
+
+	xfat_err_t err = xfile_mkfile("/rt/extent.bin");
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_mkfile("/rt/extent_gap.bin");
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_open(&file, "/rt/extent.bin");
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_open(&other, "/rt/extent_gap.bin");
+	if (err < 0) {
+		return err;
+	}
+
+	for (u32_t i = 0; i < chunk_count; i++) {
+		err = rt_file_write(&file, i * chunk_size, chunk_size, chunk_size);
+		if (err < 0) {
+			return err;
+		}
+		err = rt_file_write(&other, 0, rt_fat.cluster_byte_size, rt_fat.cluster_byte_size);
+		if (err < 0) {
+			return err;
+		}
+	}
+	xfile_close(&other);
+	xfile_close(&file);
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+
+	err = xfile_open(&file, "/rt/extent.bin");
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_set_extent_map(&file, rt_extents, sizeof(rt_extents));
+	if (err < 0) {
+		printf("set extent map failed!\n");
+		return err;
+	}
+
+	// 从后往前跳跃定位，覆盖已映射和未映射的部分
+	for (u32_t i = 0; i < 64; i++) {
+		u32_t offset = (size - 1 - i * 7919u * 13) % (size - 512);
+		err = xfile_seek(&file, offset, XFAT_SEEK_SET);
+		if (err < 0) {
+			printf("seek failed!\n");
+			return err;
+		}
+
+		memset(read_buffer, 0, 512);
+		if (xfile_read(read_buffer, 512, 1, &file) != 1) {
+			printf("read file failed!\n");
+			return -1;
+		}
+		if (memcmp(read_buffer, (u8_t*)write_buffer + offset, 512) != 0) {
+			printf("content different at %u\n", offset);
+			return -1;
+		}
+	}
+	xfile_close(&file);
+
+	err = rt_check_free(free_count - rt_cluster_count(size) - chunk_count);
+	if (err < 0) {
+		return err;
+	}
+	err = rt_file_check("/rt/extent.bin", size);
+	if (err < 0) {
+		return err;
+	}
+
+	printf("extent map test ok!\n");
+	return 0;
+}
+
+// 异步读写：批量提交分区之后保留扇区的读写请求，重新打开磁盘后批量读回比较
+int rt_async_io_test(void) {
+	static xdisk_io_t io[RT_TAIL_SECTORS];
+	u32_t start_sector = rt_disk.total_sector - RT_TAIL_SECTORS;
+	u32_t sector_size = rt_disk.sector_size;
+
+	for (int i = 0; i < RT_TAIL_SECTORS; i++) {
+		memset(io + i, 0, sizeof(xdisk_io_t));
+		io[i].is_write = 1;
+		io[i].buffer = (u8_t*)write_buffer + (RT_TAIL_SECTORS - 1 - i) * sector_size;
+		io[i].start_sector = start_sector + i;
+		io[i].count = 1;
+		xfat_err_t err = xdisk_submit(&rt_disk, io + i);
+		if (err < 0) {
+			printf("submit write failed!\n");
+			return err;
+		}
+	}
+
+	xfat_err_t err = xdisk_poll(&rt_disk, 1);
+	if (err < 0) {
+		return err;
+	}
+	err = xdisk_sync(&rt_disk);
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+
+	memset(read_buffer, 0, RT_TAIL_SECTORS * sector_size);
+	for (int i = 0; i < RT_TAIL_SECTORS; i++) {
+		memset(io + i, 0, sizeof(xdisk_io_t));
+		io[i].buffer = (u8_t*)read_buffer + i * sector_size;
+		io[i].start_sector = start_sector + i;
+		io[i].count = 1;
+		err = xdisk_submit(&rt_disk, io + i);
+		if (err < 0) {
+			printf("submit read failed!\n");
+			return err;
+		}
+	}
+
+	err = xdisk_poll(&rt_disk, 1);
+	if (err < 0) {
+		return err;
+	}
+
+	for (int i = 0; i < RT_TAIL_SECTORS; i++) {
+		if (io[i].err < 0) {
+			printf("async io failed!\n");
+			return io[i].err;
+		}
+		if (memcmp((u8_t*)read_buffer + i * sector_size, (u8_t*)write_buffer + (RT_TAIL_SECTORS - 1 - i) * sector_size, sector_size)) {
+			printf("async content different!\n");
+			return -1;
+		}
+	}
+
+	// 同步读取磁盘的最后一个扇区，应与异步写入的内容一致
+	err = xdisk_read_sector(&rt_disk, (u8_t*)read_buffer, rt_disk.total_sector - 1, 1);
+	if (err < 0) {
+		printf("read last sector failed!\n");
+		return err;
+	}
+	if (memcmp(read_buffer, write_buffer, sector_size)) {
+		printf("last sector different!\n");
+		return -1;
+	}
+
+	printf("async io test ok!\n");
+	return 0;
+}
+
+// 分散/聚集读写：按一种分段写入分区之后保留的扇区，重新打开磁盘后按另一种分段读回比较
+int rt_vector_io_test(void) {
+	u32_t sector_size = rt_disk.sector_size;
+	u32_t start_sector = rt_disk.total_sector - RT_TAIL_SECTORS;
+	u8_t* data = (u8_t*)write_buffer;
+	u8_t* read = (u8_t*)read_buffer;
+	xdisk_iovec_t iov[3];
+
+	// 磁盘上依次为write_buffer中的第3、0、1、5个扇区
+	iov[0].buffer = data + 3 * sector_size;
+	iov[0].size = sector_size;
+	iov[1].buffer = data;
+	iov[1].size = 2 * sector_size;
+	iov[2].buffer = data + 5 * sector_size;
+	iov[2].size = sector_size;
+	xfat_err_t err = xdisk_writev(&rt_disk, iov, 3, start_sector);
+	if (err < 0) {
+		printf("writev failed!\n");
+		return err;
+	}
+	err = xdisk_sync(&rt_disk);
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+
+	memset(read_buffer, 0, 8 * sector_size);
+	iov[0].buffer = read + 4 * sector_size;
+	iov[0].size = 2 * sector_size;
+	iov[1].buffer = read + 7 * sector_size;
+	iov[1].size = sector_size;
+	iov[2].buffer = read + 6 * sector_size;
+	iov[2].size = sector_size;
+	err = xdisk_readv(&rt_disk, iov, 3, start_sector);
+	if (err < 0) {
+		printf("readv failed!\n");
+		return err;
+	}
+
+	err = xdisk_read_sector(&rt_disk, read, start_sector, 4);
+	if (err < 0) {
+		return err;
+	}
+
+	if (memcmp(read, data + 3 * sector_size, sector_size) || memcmp(read + sector_size, data, 2 * sector_size) ||
+		memcmp(read + 3 * sector_size, data + 5 * sector_size, sector_size)) {
+		printf("writev content different!\n");
+		return -1;
+	}
+	if (memcmp(read + 4 * sector_size, read, 2 * sector_size) || memcmp(read + 7 * sector_size, read + 2 * sector_size, sector_size) ||
+		memcmp(read + 6 * sector_size, read + 3 * sector_size, sector_size)) {
+		printf("readv content different!\n");
+		return -1;
+	}
+
+	printf("vector io test ok!\n");
+	return 0;
+}
+
+// 缓存池测试使用磁盘自身的缓存池，enable为0时恢复为挂载时的大小。先清空原有缓存，统计只反映测试中的访问
+int rt_disk_pool(int enable) {
+	xfat_err_t err = xfat_bpool_resize(&rt_disk.obj, XFAT_BPOOL_PART_DATA, (u8_t*)0, 0);
+	if (err < 0) {
+		printf("resize disk pool failed!\n");
+		return err;
+	}
+
+	err = enable ?
+		xfat_bpool_resize(&rt_disk.obj, XFAT_BPOOL_PART_DATA, rt_pool_buf, XFAT_BUF_SIZE(rt_disk.sector_size, RT_POOL_BUF_NR)) :
+		xfat_bpool_resize(&rt_disk.obj, XFAT_BPOOL_PART_DATA, rt_disk_buf, XFAT_BUF_SIZE(rt_disk.sector_size, RT_DISK_BUF_NR));
+	if (err < 0) {
+		printf("resize disk pool failed!\n");
+		return err;
+	}
+	xfat_bpool_stats(&rt_disk.obj, XFAT_BPOOL_PART_DATA, (xfat_bpool_stats_t*)0, 1);
+	return 0;
+}
+
+// 缓存池统计：读入不超过缓存池大小的分散扇区后再读一遍，第二遍应全部命中且没有替换
+int rt_bpool_stats_test(void) {
+	u32_t start_sector = rt_part.start_sector + rt_part.total_sector / 2;
+	xfat_bpool_stats_t stats;
+
+	int err = rt_disk_pool(1);
+	if (err < 0) {
+		return err;
+	}
+
+	for (int round = 0; round < 2; round++) {
+		for (u32_t i = 0; i < RT_POOL_BUF_NR; i++) {
+			u32_t sector = start_sector + i * 37;
+			xfat_buf_t* buf;
+
+			err = xfat_bpool_read_sector(&rt_disk.obj, &buf, sector);
+			if (err < 0) {
+				return err;
+			}
+			if (buf->sector_no != sector) {
+				printf("buf sector error!\n");
+				return -1;
+			}
+		}
+	}
+
+	xfat_bpool_stats(&rt_disk.obj, XFAT_BPOOL_PART_DATA, &stats, 1);
+	if ((stats.misses != RT_POOL_BUF_NR) || (stats.hits != RT_POOL_BUF_NR) || (stats.evictions != 0)) {
+		printf("bpool stats error: hits %u, misses %u, evictions %u\n", stats.hits, stats.misses, stats.evictions);
+		return -1;
+	}
+
+	err = rt_disk_pool(0);
+	if (err < 0) {
+		return err;
+	}
+
+	printf("bpool stats test ok!\n");
+	return 0;
+}
+
+// 按策略访问：热点扇区被再次访问后，顺序扫描大量扇区，返回之后再访问热点扇区时是否命中
+int rt_bpool_scan(xfat_bpool_policy_t policy, int* hot_hit) {
+	u32_t start_sector = rt_part.start_sector + rt_part.total_sector / 2;
+	u32_t hot_sector = start_sector - 1;
+	xfat_bpool_stats_t stats;
+	xfat_buf_t* buf;
+
+	int err = rt_disk_pool(1);
+	if (err < 0) {
+		return err;
+	}
+	err = xfat_bpool_set_policy(&rt_disk.obj, XFAT_BPOOL_PART_DATA, policy);
+	if (err < 0) {
+		return err;
+	}
+
+	// 间隔几次未命中后再访问，2Q中才会提升到热区
+	err = xfat_bpool_read_sector(&rt_disk.obj, &buf, hot_sector);
+	for (u32_t i = 0; (err == FS_ERR_OK) && (i < RT_POOL_BUF_NR / 4); i++) {
+		err = xfat_bpool_read_sector(&rt_disk.obj, &buf, start_sector + RT_POOL_BUF_NR * 8 + i);
+	}
+	if (err == FS_ERR_OK) {
+		err = xfat_bpool_read_sector(&rt_disk.obj, &buf, hot_sector);
+	}
+
+	for (u32_t i = 0; (err == FS_ERR_OK) && (i < RT_POOL_BUF_NR * 4); i++) {
+		err = xfat_bpool_read_sector(&rt_disk.obj, &buf, start_sector + i);
+	}
+	if (err < 0) {
+		return err;
+	}
+
+	xfat_bpool_stats(&rt_disk.obj, XFAT_BPOOL_PART_DATA, (xfat_bpool_stats_t*)0, 1);
+	err = xfat_bpool_read_sector(&rt_disk.obj, &buf, hot_sector);
+	if (err < 0) {
+		return err;
+	}
+	xfat_bpool_stats(&rt_disk.obj, XFAT_BPOOL_PART_DATA, &stats, 1);
+	*hot_hit = stats.hits == 1;
+
+	err = xfat_bpool_set_policy(&rt_disk.obj, XFAT_BPOOL_PART_DATA, XFAT_BPOOL_LRU);
+	if (err < 0) {
+		return err;
+	}
+	return rt_disk_pool(0);
+}
+
+// 抗扫描替换：顺序扫描超过缓存池大小的扇区后，2Q仍保留热点扇区，LRU则将其换出
+int rt_bpool_2q_test(void) {
+	int hot_hit;
+
+	int err = rt_bpool_scan(XFAT_BPOOL_2Q, &hot_hit);
+	if (err < 0) {
+		return err;
+	}
+	if (!hot_hit) {
+		printf("2q lost hot sector after scan!\n");
+		return -1;
+	}
+
+	err = rt_bpool_scan(XFAT_BPOOL_LRU, &hot_hit);
+	if (err < 0) {
+		return err;
+	}
+	if (hot_hit) {
+		printf("lru kept hot sector after scan!\n");
+		return -1;
+	}
+
+	printf("bpool 2q test ok!\n");
+	return 0;
+}
+
+// 按比例回写：脏缓存超过比例后，最早变脏的扇区在同步前就已写入磁盘，同步后全部写入
+int rt_bpool_writeback_test(void) {
+	u32_t sector_size = rt_disk.sector_size;
+	u32_t start_sector = rt_disk.total_sector - RT_TAIL_SECTORS;
+	u8_t* data = (u8_t*)write_buffer + RT_TAIL_SECTORS * sector_size;
+
+	int err = rt_disk_pool(1);
+	if (err < 0) {
+		return err;
+	}
+
+	// 16个缓存中最多4个脏缓存
+	err = xfat_bpool_set_writeback(&rt_disk.obj, XFAT_BPOOL_PART_DATA, 25, 0);
+	if (err < 0) {
+		return err;
+	}
+
+	for (u32_t i = 0; i < RT_TAIL_SECTORS; i++) {
+		xfat_buf_t* buf;
+		err = xfat_bpool_read_sector(&rt_disk.obj, &buf, start_sector + i);
+		if (err < 0) {
+			return err;
+		}
+		memcpy(buf->buf, data + i * sector_size, sector_size);
+		err = xfat_bpool_write_sector(&rt_disk.obj, buf, 0);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	if (rt_disk.bpool.dirty_count > RT_POOL_BUF_NR / 4) {
+		printf("dirty count over ratio: %u\n", rt_disk.bpool.dirty_count);
+		return -1;
+	}
+
+	err = xdisk_read_sector(&rt_disk, (u8_t*)read_buffer, start_sector, 1);
+	if (err < 0) {
+		return err;
+	}
+	if (memcmp(read_buffer, data, sector_size) != 0) {
+		printf("oldest dirty sector not written back!\n");
+		return -1;
+	}
+
+	err = xfat_bpool_flush(&rt_disk.obj);
+	if (err < 0) {
+		return err;
+	}
+	err = xdisk_read_sector(&rt_disk, (u8_t*)read_buffer, start_sector, RT_TAIL_SECTORS);
+	if (err < 0) {
+		return err;
+	}
+	if (memcmp(read_buffer, data, RT_TAIL_SECTORS * sector_size) != 0) {
+		printf("write back content error!\n");
+		return -1;
+	}
+
+	err = xfat_bpool_set_writeback(&rt_disk.obj, XFAT_BPOOL_PART_DATA, 0, 0);
+	if (err < 0) {
+		return err;
+	}
+	err = rt_disk_pool(0);
+	if (err < 0) {
+		return err;
+	}
+
+	printf("bpool writeback test ok!\n");
+	return 0;
+}
+
+// 直通缓存：FAT表及目录缓存直接指向磁盘映射，驱动不支持内存映射时跳过
+int rt_map_pool_test(void) {
+	u32_t size = 100 * 1024;
+
+	if (xdisk_map_sector(&rt_disk, 0, 1) == (u8_t*)0) {
+		printf("disk map not supported, skip map pool test\n");
+		return 0;
+	}
+
+	xfat_err_t err = xfat_bpool_set_map(&rt_fat.obj, XFAT_BPOOL_PART_FAT, 1);
+	if (err < 0) {
+		printf("set fat map failed!\n");
+		return err;
+	}
+	err = xfat_bpool_set_map(&rt_fat.obj, XFAT_BPOOL_PART_DIR, 1);
+	if (err < 0) {
+		printf("set dir map failed!\n");
+		return err;
+	}
+
+	u32_t free_count = rt_fat.cluster_total_free;
+	err = xfile_mkdir("/rt/map_dir");
+	if (err < 0) {
+		return err;
+	}
+	err = rt_create_file("/rt/map_dir/file.bin", size, 4096);
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_check_free(free_count - 1 - rt_cluster_count(size));
+	if (err < 0) {
+		return err;
+	}
+	err = rt_file_check("/rt/map_dir/file.bin", size);
+	if (err < 0) {
+		return err;
+	}
+
+	printf("map pool test ok!\n");
+	return 0;
+}
+
+// 数据区末尾：缩小引导扇区中的总扇区数，使FAT表末尾的簇项超出数据区，写满卷后超出部分的扇区不能被改动
+int rt_data_end_test(void) {
+	static u8_t sector_buf[XDISK_SECTOR_SIZE_MAX];
+	u32_t part_start = rt_part.start_sector;
+	u32_t sec_per_cluster = rt_fat.sec_per_cluster;
+	u32_t data_start = rt_fat.fat_start_sector + rt_fat.fat_tbl_nr * rt_fat.fat_tbl_sectors - part_start;
+	u32_t fat_clusters = rt_fat.fat_tbl_sectors * rt_disk.sector_size / sizeof(cluster32_t);
+	u32_t data_clusters = fat_clusters - 2 - 64;
+	u32_t total_sectors = data_start + data_clusters * sec_per_cluster;
+	u32_t fsi_sector = rt_fat.fsi_sector;
+	xfile_t file;
+
+	int err = rt_unmount();
+	if (err < 0) {
+		return err;
+	}
+	err = xdisk_open(&rt_disk, "rt_disk", rt_driver, (void*)disk_path_rt, rt_disk_buf, sizeof(rt_disk_buf));
+	if (err < 0) {
+		return err;
+	}
+
+	// 缩小总扇区数，并使FSInfo中的空闲簇数失效，挂载时重新统计
+	err = xdisk_read_sector(&rt_disk, sector_buf, part_start, 1);
+	if (err < 0) {
+		return err;
+	}
+	((dbr_t*)sector_buf)->bpb.BPB_TotSec32 = total_sectors;
+	err = xdisk_write_sector(&rt_disk, sector_buf, part_start, 1);
+	if (err < 0) {
+		return err;
+	}
+
+	err = xdisk_read_sector(&rt_disk, sector_buf, part_start + fsi_sector, 1);
+	if (err < 0) {
+		return err;
+	}
+	((fsinfo_t*)sector_buf)->FSI_Free_Count = 0xFFFFFFFF;
+	err = xdisk_write_sector(&rt_disk, sector_buf, part_start + fsi_sector, 1);
+	if (err < 0) {
+		return err;
+	}
+
+	err = xdisk_write_sector(&rt_disk, (u8_t*)write_buffer, part_start + total_sectors, sec_per_cluster);
+	if (err < 0) {
+		return err;
+	}
+	err = xdisk_close(&rt_disk);
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_mount();
+	if (err < 0) {
+		return err;
+	}
+
+	u32_t free_count = rt_fat.cluster_total_free;
+	if (free_count > data_clusters - 1) {
+		printf("free count beyond data area: %u\n", free_count);
+		return -1;
+	}
+	err = rt_check_free(free_count);
+	if (err < 0) {
+		return err;
+	}
+
+	// 启用位图后写满整个卷
+	err = xfat_set_free_map(&rt_fat, rt_free_map, sizeof(rt_free_map));
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_mkfile("/rt/fill.bin");
+	if (err < 0) {
+		return err;
+	}
+	err = xfile_open(&file, "/rt/fill.bin");
+	if (err < 0) {
+		return err;
+	}
+	while (xfile_write(write_buffer, sizeof(write_buffer), 1, &file) == 1) {
+	}
+	xfile_close(&file);
+
+	err = rt_remount();
+	if (err < 0) {
+		return err;
+	}
+	err = rt_check_free(0);
+	if (err < 0) {
+		return err;
+	}
+
+	memset(read_buffer, 0, sec_per_cluster * rt_disk.sector_size);
+	err = xdisk_read_sector(&rt_disk, (u8_t*)read_buffer, part_start + total_sectors, sec_per_cluster);
+	if (err < 0) {
+		return err;
+	}
+	if (memcmp(read_buffer, write_buffer, sec_per_cluster * rt_disk.sector_size) != 0) {
+		printf("sectors beyond data area changed!\n");
+		return -1;
+	}
+
+	printf("data end test ok!\n");
+	return 0;
+}
+
+// 在指定扇区大小的新映像上格式化，依次执行各往返测试
+int round_trip_test(xdisk_driver_t* driver, u32_t sector_size) {
+	xfat_fmt_ctrl_t ctrl;
+
+	printf("round trip test, sector size %u\n", sector_size);
+	int err = create_disk_image(disk_path_rt, sector_size);
+	if (err < 0) {
+		return err;
+	}
+
+	rt_driver = driver;
+	err = xdisk_open(&rt_disk, "rt_disk", rt_driver, (void*)disk_path_rt, rt_disk_buf, sizeof(rt_disk_buf));
+	if (err < 0) {
+		printf("open disk failed!\n");
+		return err;
+	}
+	if (rt_disk.sector_size != sector_size) {
+		printf("sector size detect failed: %u\n", rt_disk.sector_size);
+		return -1;
+	}
+
+	err = xdisk_get_part(&rt_disk, &rt_part, 0);
+	if (err < 0) {
+		return err;
+	}
+
+	xfat_fmt_ctrl_init(&ctrl);
+	ctrl.vol_name = "XFAT RT";
+	err = xfat_format(&rt_part, &ctrl);
+	if (err < 0) {
+		printf("format failed!\n");
+		return err;
+	}
+
+	err = xdisk_close(&rt_disk);
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_mount();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_check_free(rt_fat.cluster_total_free);
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_resplit_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_pin_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_mirror_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_free_map_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_alloc_run_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_fallocate_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_delalloc_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_delalloc_full_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_extent_map_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_async_io_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_vector_io_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_bpool_stats_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_bpool_2q_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_bpool_writeback_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_map_pool_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_data_end_test();
+	if (err < 0) {
+		return err;
+	}
+
+	err = rt_unmount();
+	if (err < 0) {
+		return err;
+	}
+
+	remove(disk_path_rt);
+	printf("round trip test ok!\n");
+	return 0;
+}
+
+int main(void) {
+#define DISK_BUF_NR 3
+	static u8_t disk_buf[XFAT_BUF_SIZE(XDISK_SECTOR_SIZE_MAX, DISK_BUF_NR)];
+	static u8_t fat_buf[XFAT_BUF_SIZE(XDISK_SECTOR_SIZE_MAX, 2 + 2 + 4)];
+
+	for (int i = 0; i < sizeof(write_buffer) / sizeof(u32_t); i++) {
+		write_buffer[i] = i;
+	}
+
+	int err = disk_io_test();
+	if (err) {
+		return err;
+	}
+
+	err = xdisk_open(&disk, "vdisk", &vdisk_driver, (void*)disk_path, disk_buf, sizeof(disk_buf));
+	if (err) {
+		printf("open disk failed!\n");
+		return -1;
+	}
+
+	err = xfat_bpool_resize(&disk.obj, XFAT_BPOOL_PART_DATA, disk_buf, XFAT_BUF_SIZE(disk.sector_size, DISK_BUF_NR));
+	if (err) {
+		printf("resize disk buf failed!\n");
+		return -1;
+	}
+
+	err = disk_part_test();
+	if (err) {
+		return err;
+	}
+
+	err = xdisk_get_part(&disk, &disk_part, 1);
+	if (err < 0) {
+		printf("read partion failed!\n");
+		return -1;
+	}
+
+	err = xfat_init();
+	if (err < 0) {
+		return err;
+	}
+
+	err = xfat_mount(&xfat, &disk_part, "mp0");
+	if (err < 0) {
+		printf("open fat failed!\n");
+		return -1;
+	}
+
+	err = xfat_set_buf(&xfat, fat_buf, XFAT_BUF_SIZE(disk.sector_size, 2), XFAT_BUF_SIZE(disk.sector_size, 2),
+		XFAT_BUF_SIZE(disk.sector_size, 4));
+	if (err < 0) {
+		printf("set fat buf failed!\n");
+		return err;
+	}
+
+	err = fat_dir_test();
+	if (err) {
+		return err;
+	}
+
+	err = fat_file_test();
+	if (err) {
+		return err;
+	}
+
+	err = fs_open_test();
+	if (err) {
+		return err;
+	}
+
+	err = dir_traverse_test();
+	if (err) {
+		return err;
+	}
+
+	err = fs_read_test();
+	if (err < 0) {
+		printf("read test failed\n");
+		return -1;
+	}
+
+	err = fs_seek_test();
+	if (err) {
+		return err;
+	}
+
+	err = fs_modify_file_test();
+	if (err) {
+		return err;
+	}
+
+	err = fs_write_test();
+	if (err) {
+		return err;
+	}
+
+	err = fs_create_test();
+	if (err) {
+		return err;
+	}
+
+	err = fs_rmdir_tree_test();
+	if (err) {
+		return err;
+	}
+
+	err = fs_resize_test();
+	if (err) {
+		return err;
+	}
+
+	err = fs_format_test();
+	if (err) {
+		return err;
+	}
+
+	err = round_trip_test(&vdisk_driver, XDISK_SECTOR_SIZE_MIN);
+	if (err) {
+		return err;
+	}
+
+	// 4Kn磁盘
+	err = round_trip_test(&vdisk_driver, XDISK_SECTOR_SIZE_MAX);
+	if (err) {
+		return err;
+	}
+
+#ifndef _WIN32
+	err = round_trip_test(&posix_disk_driver, XDISK_SECTOR_SIZE_MIN);
+	if (err) {
+		return err;
+	}
+
+	err = round_trip_test(&posix_mmap_disk_driver, XDISK_SECTOR_SIZE_MIN);
 	if (err) {
 		return err;
 	}
+#endif
 
 	err = xdisk_close(&disk);
 	if (err) {
@@ -1,5 +1,8 @@
+#include <string.h>
 #include "xdisk.h"
 
+static u8_t zero_buf[XDISK_ZERO_BUF_SIZE];
+
 xfat_err_t xdisk_open(xdisk_t* disk, const char* name, xdisk_driver_t* driver,
 	void* init_data, u8_t* disk_buf, u32_t buf_size) {
 	xfat_err_t err;
@@ -9,13 +12,95 @@ xfat_err_t xdisk_open(xdisk_t* disk, const char* name, xdisk_driver_t* driver,
 	if (err < 0) {
 		return err;
 	}
-	err = xfat_bpool_init(to_obj(disk), disk->sector_size, disk_buf, buf_size);
+	err = xfat_bpool_init(to_obj(disk), disk->sector_size, disk_buf, buf_size, XFAT_BPOOL_LRU);
 	if (err < 0) {
 		return err;
 	}
 	disk->name = name;
 	return FS_ERR_OK;
 }
+/**
+ * 供驱动按映像的字节大小计算扇区数，超出32位扇区号的部分无法访问
+ */
+u32_t xdisk_size_to_sectors(xdisk_t* disk, u64_t size) {
+	u64_t count = size / disk->sector_size;
+	return (count > 0xFFFFFFFF) ? 0xFFFFFFFF : (u32_t)count;
+}
+
+/**
+ * 检查是否为FAT32引导扇区，是则返回其中记录的扇区大小
+ */
+static u32_t boot_sector_size(const u8_t* sector) {
+	u32_t size = sector[11] | (sector[12] << 8);        // BPB_BytsPerSec
+
+	if ((sector[510] != 0x55) || (sector[511] != 0xAA)) {
+		return 0;
+	}
+	if (((sector[0] != 0xEB) && (sector[0] != 0xE9)) || memcmp(sector + 82, "FAT32", 5)) {
+		return 0;
+	}
+	if ((size < XDISK_SECTOR_SIZE_MIN) || (size > XDISK_SECTOR_SIZE_MAX) || (size & (size - 1))) {
+		return 0;
+	}
+	return size;
+}
+
+/**
+ * 供无法向设备查询扇区大小的驱动（如磁盘映像）推测逻辑扇区大小。
+ * 依据已有的FAT32引导扇区：位于映像开头时直接取其BPB_BytsPerSec；为MBR时，
+ * 按4K扇区计算分区起始位置，若该处的引导扇区也记录为4K，则为4Kn映像。
+ * 分区尚未格式化时，若分区表按4K扇区解释恰好延伸到磁盘末尾（1MB对齐余量内），也视为4Kn。无法判断时为512
+ * @param read 读取指定字节偏移处的512字节
+ * @param data 传给read的参数
+ * @param buffer 至少512字节的缓冲区
+ * @param disk_size 磁盘字节大小
+ */
+u32_t xdisk_probe_sector_size(xfat_err_t (*read)(void* data, u8_t* buffer, u64_t offset), void* data,
+	u8_t* buffer, u64_t disk_size) {
+	mbr_t* mbr = (mbr_t*)buffer;
+	u32_t part_start[MBR_PRIMARY_PART_NR];
+	u64_t part_end = 0;
+	u32_t size;
+	int i;
+
+	if (read(data, buffer, 0) < 0) {
+		return XDISK_SECTOR_SIZE_MIN;
+	}
+
+	size = boot_sector_size(buffer);
+	if (size) {
+		return size;
+	}
+	if ((mbr->boot_sig[0] != 0x55) || (mbr->boot_sig[1] != 0xAA)) {
+		return XDISK_SECTOR_SIZE_MIN;
+	}
+
+	for (i = 0; i < MBR_PRIMARY_PART_NR; i++) {
+		mbr_part_t* part = mbr->part_info + i;
+		part_start[i] = (part->system_id != FS_NOT_VALID) ? part->relative_sectors : 0;
+		if (part_start[i] && ((u64_t)part->relative_sectors + part->total_sectors > part_end)) {
+			part_end = (u64_t)part->relative_sectors + part->total_sectors;
+		}
+	}
+	part_end *= XDISK_SECTOR_SIZE_MAX;
+
+	for (i = 0; i < MBR_PRIMARY_PART_NR; i++) {
+		if (part_start[i] == 0) {
+			continue;
+		}
+		if (read(data, buffer, (u64_t)part_start[i] * XDISK_SECTOR_SIZE_MAX) < 0) {
+			continue;
+		}
+		if (boot_sector_size(buffer) == XDISK_SECTOR_SIZE_MAX) {
+			return XDISK_SECTOR_SIZE_MAX;
+		}
+	}
+	if (part_end && (part_end <= disk_size) && (part_end + 1024 * 1024 > disk_size)) {
+		return XDISK_SECTOR_SIZE_MAX;
+	}
+	return XDISK_SECTOR_SIZE_MIN;
+}
+
 xfat_err_t xdisk_close(xdisk_t* disk) {
 	xfat_err_t err = xfat_bpool_flush(to_obj(disk));
 	if (err < 0) {
@@ -25,19 +110,168 @@ xfat_err_t xdisk_close(xdisk_t* disk) {
 }
 
 xfat_err_t xdisk_read_sector(xdisk_t* disk, u8_t* buffer, u32_t start_sector, u32_t count) {
-	if (start_sector + count >= disk->total_sector) {
+	if ((u64_t)start_sector + count > disk->total_sector) {
 		return FS_ERR_PARAM;
 	}
 	return disk->driver->read_sector(disk, buffer, start_sector, count);
 }
 
 xfat_err_t xdisk_write_sector(xdisk_t* disk, u8_t* buffer, u32_t start_sector, u32_t count) {
-	if (start_sector + count >= disk->total_sector) {
+	if ((u64_t)start_sector + count > disk->total_sector) {
 		return FS_ERR_PARAM;
 	}
 	return disk->driver->write_sector(disk, buffer, start_sector, count);
 }
 
+/**
+ * 分散/聚集读写：[start_sector, ...)中的连续扇区依次对应iov中的各段缓冲区。
+ * 驱动不支持时逐段调用read_sector/write_sector
+ */
+static xfat_err_t disk_rw_vector(xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector, u8_t is_write) {
+	u32_t count = 0;
+	for (u32_t i = 0; i < iov_count; i++) {
+		count += iov[i].size / disk->sector_size;
+	}
+	if ((u64_t)start_sector + count > disk->total_sector) {
+		return FS_ERR_PARAM;
+	}
+
+	if (is_write && disk->driver->writev) {
+		return disk->driver->writev(disk, iov, iov_count, start_sector);
+	}
+	else if (!is_write && disk->driver->readv) {
+		return disk->driver->readv(disk, iov, iov_count, start_sector);
+	}
+
+	for (u32_t i = 0; i < iov_count; i++) {
+		u32_t curr_count = iov[i].size / disk->sector_size;
+		xfat_err_t err = is_write ? disk->driver->write_sector(disk, iov[i].buffer, start_sector, curr_count) :
+			disk->driver->read_sector(disk, iov[i].buffer, start_sector, curr_count);
+		if (err < 0) {
+			return err;
+		}
+		start_sector += curr_count;
+	}
+	return FS_ERR_OK;
+}
+
+xfat_err_t xdisk_readv(xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector) {
+	return disk_rw_vector(disk, iov, iov_count, start_sector, 0);
+}
+
+xfat_err_t xdisk_writev(xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector) {
+	return disk_rw_vector(disk, iov, iov_count, start_sector, 1);
+}
+
+// 驱动是否直接支持分散/聚集读写，不支持时调用者宜自行合并到连续缓冲区
+u8_t xdisk_has_vector_io(xdisk_t* disk) {
+	return (disk->driver->readv != 0) && (disk->driver->writev != 0);
+}
+
+// 驱动支持内存映射时，返回扇区在映射中的地址，可直接读写；否则返回0
+u8_t* xdisk_map_sector(xdisk_t* disk, u32_t start_sector, u32_t count) {
+	if ((disk->driver->map_sector == 0) || ((u64_t)start_sector + count > disk->total_sector)) {
+		return (u8_t*)0;
+	}
+	return disk->driver->map_sector(disk, start_sector, count);
+}
+
+xfat_err_t xdisk_sync_sector(xdisk_t* disk, u32_t start_sector, u32_t count) {
+	if (disk->driver->sync_sector == 0) {
+		return FS_ERR_OK;
+	}
+	return disk->driver->sync_sector(disk, start_sector, count);
+}
+
+/**
+ * 持久化屏障：之前写入的扇区全部落到存储介质上后返回。驱动不支持时认为写入即已持久
+ */
+xfat_err_t xdisk_sync(xdisk_t* disk) {
+	if (disk->driver->sync == 0) {
+		return FS_ERR_OK;
+	}
+	return disk->driver->sync(disk);
+}
+
+/**
+ * 通知驱动扇区内容已不再需要，之后读到的内容不确定。仅为优化提示，驱动不支持时忽略
+ */
+xfat_err_t xdisk_discard(xdisk_t* disk, u32_t start_sector, u32_t count) {
+	if ((u64_t)start_sector + count > disk->total_sector) {
+		return FS_ERR_PARAM;
+	}
+	if ((disk->driver->discard == 0) || (count == 0)) {
+		return FS_ERR_OK;
+	}
+	return disk->driver->discard(disk, start_sector, count);
+}
+
+/**
+ * 将连续扇区清0。优先由驱动完成（如映像文件直接标记为全0区域），否则按大块写入全0数据
+ */
+xfat_err_t xdisk_write_zeroes(xdisk_t* disk, u32_t start_sector, u32_t count) {
+	if ((u64_t)start_sector + count > disk->total_sector) {
+		return FS_ERR_PARAM;
+	}
+
+	if (disk->driver->write_zeroes) {
+		xfat_err_t err = disk->driver->write_zeroes(disk, start_sector, count);
+		if (err != FS_ERR_NONE) {
+			return err;
+		}
+	}
+
+	u32_t max_count = sizeof(zero_buf) / disk->sector_size;
+	while (count > 0) {
+		u32_t curr_count = (count > max_count) ? max_count : count;
+		xfat_err_t err = disk->driver->write_sector(disk, zero_buf, start_sector, curr_count);
+		if (err < 0) {
+			return err;
+		}
+		start_sector += curr_count;
+		count -= curr_count;
+	}
+	return FS_ERR_OK;
+}
+
+/**
+ * 提交异步读写请求，结果在请求完成后存放在io->err中。驱动不支持异步时直接同步完成
+ */
+xfat_err_t xdisk_submit(xdisk_t* disk, xdisk_io_t* io) {
+	if ((u64_t)io->start_sector + io->count > disk->total_sector) {
+		io->err = FS_ERR_PARAM;
+		return io->err;
+	}
+
+	if (disk->driver->submit == 0) {
+		if (io->iov_count > 0) {
+			io->err = disk_rw_vector(disk, io->iov, io->iov_count, io->start_sector, io->is_write);
+		}
+		else {
+			io->err = io->is_write ? disk->driver->write_sector(disk, io->buffer, io->start_sector, io->count) :
+				disk->driver->read_sector(disk, io->buffer, io->start_sector, io->count);
+		}
+		return io->err;
+	}
+
+	io->err = FS_ERR_OK;
+	xfat_err_t err = disk->driver->submit(disk, io);
+	if (err < 0) {
+		io->err = err;
+	}
+	return err;
+}
+
+/**
+ * 收取已完成的异步请求，wait非0时等待全部请求完成。返回仍未完成的请求数
+ */
+xfat_err_t xdisk_poll(xdisk_t* disk, u8_t wait) {
+	if (disk->driver->poll == 0) {
+		return 0;
+	}
+	return disk->driver->poll(disk, wait);
+}
+
 xfat_err_t xdisk_curr_time(struct _xdisk_t* disk, struct _xfile_time_t* timeinfo) {
 	return disk->driver->curr_time(disk, timeinfo);
 }
@@ -216,7 +450,7 @@ static xfat_err_t set_ext_part_type(xdisk_part_t* part, u32_t ext_start_sector,
 			return err;
 		}
 
-		if ((++ext_part)->system_id != FS_EXTEND) { // ޺δҵ, 
+		if ((++ext_part)->system_id != FS_EXTEND) { // 无后续分区，设置未找到, 返回
 			err = FS_ERR_EOF;
 			break;
 		}
@@ -36,15 +36,52 @@ typedef struct _mbr_t {
 
 #pragma pack()
 
+#define XDISK_SECTOR_SIZE_MIN       512         // 支持的逻辑扇区大小范围，MBR等结构位于扇区开头的512字节
+#define XDISK_SECTOR_SIZE_MAX       4096
+#define XDISK_ZERO_BUF_SIZE         (64 * 1024) // 驱动不支持清0时，每次写入的全0数据大小
+
 struct _xdisk_t;
 struct _xfile_time_t;
 
+/**
+ * 分散/聚集读写中的一段缓冲区，size为扇区大小的整数倍
+ */
+typedef struct _xdisk_iovec_t {
+	u8_t* buffer;
+	u32_t size;
+} xdisk_iovec_t;
+
+/**
+ * 异步扇区读写请求，完成前请求本身及其缓冲区须保持有效
+ */
+typedef struct _xdisk_io_t {
+	u8_t is_write;
+	u8_t* buffer;
+	xdisk_iovec_t* iov;                             // iov_count非0时读写iov中的各段，忽略buffer
+	u32_t iov_count;
+	u32_t start_sector;
+	u32_t count;
+	xfat_err_t err;                                 // 完成后的结果
+	struct _xdisk_io_t* next;                       // 驱动内部排队用
+} xdisk_io_t;
+
 typedef struct _xdisk_driver_t {
 	xfat_err_t(*open)(struct _xdisk_t* disk, void* init_data);
 	xfat_err_t(*close)(struct _xdisk_t* disk);
 	xfat_err_t(*curr_time)(struct _xdisk_t* disk, struct _xfile_time_t* timeinfo);
 	xfat_err_t(*read_sector)(struct _xdisk_t* disk, u8_t* buffer, u32_t start_sector, u32_t count);
 	xfat_err_t(*write_sector)(struct _xdisk_t* disk, u8_t* buffer, u32_t start_sector, u32_t count);
+
+	// 以下为可选接口，驱动不支持时置空
+	u8_t* (*map_sector)(struct _xdisk_t* disk, u32_t start_sector, u32_t count);    // 返回扇区在内存映射中的地址
+	xfat_err_t(*sync_sector)(struct _xdisk_t* disk, u32_t start_sector, u32_t count); // 将映射中修改过的扇区写入磁盘
+	xfat_err_t(*submit)(struct _xdisk_t* disk, xdisk_io_t* io);                     // 提交异步请求
+	xfat_err_t(*poll)(struct _xdisk_t* disk, u8_t wait);                           // 收取完成的请求，返回仍未完成的数量
+	xfat_err_t(*readv)(struct _xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector);  // 连续扇区读入多段缓冲区
+	xfat_err_t(*writev)(struct _xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector); // 多段缓冲区写入连续扇区
+	xfat_err_t(*sync)(struct _xdisk_t* disk);                                        // 已写入的数据落到存储介质上后返回
+	xfat_err_t(*discard)(struct _xdisk_t* disk, u32_t start_sector, u32_t count);   // 扇区内容不再需要，可释放其存储空间
+	xfat_err_t(*write_zeroes)(struct _xdisk_t* disk, u32_t start_sector, u32_t count); // 扇区清0，无法高效完成时返回FS_ERR_NONE
 } xdisk_driver_t;
 
 typedef struct _xdisk_t {
@@ -65,14 +102,31 @@ typedef struct _xdisk_part_t {
 	xdisk_t* disk;
 } xdisk_part_t;
 
+// 扇区号为32位，字节偏移及大小按64位计算，超过4GB的映像不会回绕
+#define xdisk_sector_offset(disk, sector)   ((u64_t)(sector) * (disk)->sector_size)
+#define xdisk_part_size(part)               xdisk_sector_offset((part)->disk, (part)->total_sector)
+
 xfat_err_t xdisk_open(xdisk_t* disk, const char* name, xdisk_driver_t* driver, void* init_data,
 	u8_t* disk_buf, u32_t buf_size);
 xfat_err_t xdisk_close(xdisk_t* disk);
+u32_t xdisk_size_to_sectors(xdisk_t* disk, u64_t size);
+u32_t xdisk_probe_sector_size(xfat_err_t (*read)(void* data, u8_t* buffer, u64_t offset), void* data,
+	u8_t* buffer, u64_t disk_size);
 xfat_err_t xdisk_get_part_count(xdisk_t* disk, u32_t* count);
 xfat_err_t xdisk_get_part(xdisk_t* disk, xdisk_part_t* xdisk_part, int part_no);
 xfat_err_t xdisk_curr_time(struct _xdisk_t* disk, struct _xfile_time_t* timeinfo);
 xfat_err_t xdisk_read_sector(xdisk_t* disk, u8_t* buffer, u32_t start_sector, u32_t count);
 xfat_err_t xdisk_write_sector(xdisk_t* disk, u8_t* buffer, u32_t start_sector, u32_t count);
+xfat_err_t xdisk_readv(xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector);
+xfat_err_t xdisk_writev(xdisk_t* disk, xdisk_iovec_t* iov, u32_t iov_count, u32_t start_sector);
+u8_t xdisk_has_vector_io(xdisk_t* disk);
+u8_t* xdisk_map_sector(xdisk_t* disk, u32_t start_sector, u32_t count);
+xfat_err_t xdisk_sync_sector(xdisk_t* disk, u32_t start_sector, u32_t count);
+xfat_err_t xdisk_sync(xdisk_t* disk);
+xfat_err_t xdisk_discard(xdisk_t* disk, u32_t start_sector, u32_t count);
+xfat_err_t xdisk_write_zeroes(xdisk_t* disk, u32_t start_sector, u32_t count);
+xfat_err_t xdisk_submit(xdisk_t* disk, xdisk_io_t* io);
+xfat_err_t xdisk_poll(xdisk_t* disk, u8_t wait);
 xfat_err_t xdisk_set_part_type(xdisk_part_t* disk, xfs_type_t type);
 
 #endif
\ No newline at end of file
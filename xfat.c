@@ -17,8 +17,9 @@
 #define to_sector_offset(disk, offset) ((offset) % (disk)->sector_size)
 #define to_cluster_offset(xfat, pos) ((pos) % (xfat)->cluster_byte_size)
 #define to_cluster(xfat, pos) ((pos) / (xfat)->cluster_byte_size)
-#define to_cluster_count(xfat, size) ((size) ? (to_cluster(xfat, size) + 1) : 0)
+#define to_cluster_count(xfat, size) ((size) ? to_cluster(xfat, (size) - 1) + 1 : 0)
 
+static u8_t fat_sync_buf[XFAT_MIRROR_SYNC_SIZE];
 
 u32_t to_fat_sector(xfat_t* xfat, u32_t cluster) {
 	u32_t sector_size = xfat_get_disk(xfat)->sector_size;
@@ -109,13 +110,18 @@ xfat_err_t xfat_init(void) {
 static xfat_err_t parse_fat_header(xfat_t* xfat, dbr_t* dbr) {
 	xdisk_part_t* xdisk_part = xfat->disk_part;
 
+	// 分区按磁盘的逻辑扇区寻址，两者不一致时扇区号无法换算
+	if (dbr->bpb.BPB_BytsPerSec != xdisk_part->disk->sector_size) {
+		return FS_ERR_INVALID_FS;
+	}
+
 	xfat->root_cluster = dbr->fat32.BPB_RootClus;
 	xfat->fat_tbl_sectors = dbr->fat32.BPB_FATSz32;
 
-	// Bits 0 - 3: ǰFATţ0 - 15
-	// Bits 4 - 6 : ͨΪ0
-	// Bit 7 : FAT²ԣ0 = ͬFAT1 = µǰFAT
-	// Bits 8 - 15 : ͨΪ0
+	// Bits 0 - 3: 当前活动的FAT表编号（0 - 15）。
+	// Bits 4 - 6 : 保留（通常为0）。
+	// Bit 7 : FAT表更新策略（0 = 同步更新所有FAT表，1 = 仅更新当前活动FAT表）。
+	// Bits 8 - 15 : 保留（通常为0）。
 	if (dbr->fat32.BPB_ExtFlags & (1 << 7)) {
 		u32_t table = dbr->fat32.BPB_ExtFlags & 0XF;
 		xfat->fat_start_sector = dbr->bpb.BPB_RsvdSecCnt + xdisk_part->start_sector + table * xfat->fat_tbl_sectors;
@@ -148,6 +154,8 @@ xfat_err_t add_to_mount(xfat_t* xfat, const char* mount_name) {
 	return FS_ERR_OK;
 }
 
+static u32_t fat_cluster_count(xfat_t* xfat);
+
 static xfat_err_t load_cluster_free_info(xfat_t* xfat) {
 	xfat_buf_t* buf;
 	xfat_err_t err = xfat_bpool_read_sector(to_obj(xfat), &buf, xfat->fsi_sector + xfat->disk_part->start_sector);
@@ -170,6 +178,8 @@ static xfat_err_t load_cluster_free_info(xfat_t* xfat) {
 		u32_t sector_count = xfat->fat_tbl_sectors;
 		u32_t free_count = 0;
 		u32_t next_free = 0;
+		u32_t cluster_no = 0;
+		u32_t cluster_count = fat_cluster_count(xfat);
 
 		while (sector_count--) {
 			err = xfat_bpool_read_sector(to_obj(xfat), &buf, start_sector++);
@@ -178,11 +188,11 @@ static xfat_err_t load_cluster_free_info(xfat_t* xfat) {
 			}
 
 			cluster32_t* cluster = (cluster32_t*)(buf->buf);
-			for (u32_t i = 0; i < sector_size; i += sizeof(cluster32_t), cluster++) {
-				if (cluster->s.next == CLUSTER_FREE) {
+			for (u32_t i = 0; i < sector_size; i += sizeof(cluster32_t), cluster++, cluster_no++) {
+				if ((cluster_no < cluster_count) && (cluster->s.next == CLUSTER_FREE)) {
 					free_count++;
 					if (next_free == 0) {
-						next_free = i / sizeof(cluster32_t);
+						next_free = cluster_no;
 					}
 				}
 			}
@@ -195,28 +205,29 @@ static xfat_err_t load_cluster_free_info(xfat_t* xfat) {
 	return FS_ERR_OK;
 }
 
-static xfat_err_t save_cluster_free_info(xdisk_t* disk, u32_t total_free, u32_t next_free,
+// fsinfo_sector为绝对扇区号，备份位于其后backup_sector个扇区处
+static xfat_err_t save_cluster_free_info(xfat_obj_t* obj, u32_t sector_size, u32_t total_free, u32_t next_free,
 	u32_t fsinfo_sector, u32_t backup_sector) {
 	xfat_buf_t* buf = (xfat_buf_t*)0;
-	xfat_err_t err = xfat_bpool_alloc(to_obj(disk), &buf, fsinfo_sector);
+	xfat_err_t err = xfat_bpool_alloc(obj, &buf, fsinfo_sector);
 	if (err < 0) {
 		return err;
 	}
 
 	fsinfo_t* fsinfo = (fsinfo_t*)(buf->buf);
-	memset(fsinfo, 0, sizeof(fsinfo_t));
+	memset(fsinfo, 0, sector_size);
 	fsinfo->FSI_LoadSig = 0x41615252;
 	fsinfo->FSI_StrucSig = 0x61417272;
 	fsinfo->FSI_Free_Count = total_free;
 	fsinfo->FSI_Next_Free = next_free;
 	fsinfo->FSI_TrailSig = 0xAA550000;
 
-	err = xfat_bpool_write_sector(to_obj(disk), buf, 1);
+	err = xfat_bpool_write_sector(obj, buf, 1);
 	if (err < 0) {
 		return err;
 	}
 	buf->sector_no += backup_sector;
-	err = xfat_bpool_write_sector(to_obj(disk), buf, 1);
+	err = xfat_bpool_write_sector(obj, buf, 1);
 	if (err < 0) {
 		return err;
 	}
@@ -231,8 +242,23 @@ xfat_err_t xfat_mount(xfat_t* xfat, xdisk_part_t* xdisk_part, const char* mount_
 	xfat_buf_t* buf = (xfat_buf_t*)0;
 
 	xfat_obj_init(to_obj(xfat), XFAT_OBJ_FAT);
+	xfat->fat_mirror_defer = 0;
+	xfat->mirror_dirty_start = xfat->mirror_dirty_end = 0;
+	xfat->free_map = (u32_t*)0;
+	xfat->free_map_words = 0;
+	xfat->discard_run_count = 0;
+
+	xfat_err_t err = xfat_bpool_init_part(to_obj(xfat), XFAT_BPOOL_PART_FAT, 0, 0, 0, XFAT_BPOOL_LRU);
+	if (err < 0) {
+		return err;
+	}
+
+	err = xfat_bpool_init_part(to_obj(xfat), XFAT_BPOOL_PART_DIR, 0, 0, 0, XFAT_BPOOL_LRU);
+	if (err < 0) {
+		return err;
+	}
 
-	xfat_err_t err = xfat_bpool_init(to_obj(xfat), 0, 0, 0);
+	err = xfat_bpool_init(to_obj(xfat), 0, 0, 0, XFAT_BPOOL_2Q);
 	if (err < 0) {
 		return err;
 	}
@@ -255,26 +281,97 @@ xfat_err_t xfat_mount(xfat_t* xfat, xdisk_part_t* xdisk_part, const char* mount_
 	return add_to_mount(xfat, mount_name);
 }
 
+static xfat_err_t discard_free_runs(xfat_t* xfat);
+
+/**
+ * 持久化点：同步FAT镜像表、写入FSInfo并回写全部脏缓存，再要求磁盘将已写入的数据落到存储介质上，
+ * 之后回收已释放簇的存储空间。两次调用之间的写入可由驱动自由缓冲
+ */
+xfat_err_t xfat_sync(xfat_t* xfat) {
+	xfat_err_t err = save_cluster_free_info(to_obj(xfat), xfat_get_disk(xfat)->sector_size, xfat->cluster_total_free,
+		xfat->cluster_next_free, xfat->disk_part->start_sector + xfat->fsi_sector, xfat->backup_sector);
+	if (err < 0) {
+		return err;
+	}
+
+	err = xfat_bpool_flush(to_obj(xfat));
+	if (err < 0) {
+		return err;
+	}
+
+	err = xfat_sync_fat_mirror(xfat);
+	if (err < 0) {
+		return err;
+	}
+
+	err = xdisk_sync(xfat_get_disk(xfat));
+	if (err < 0) {
+		return err;
+	}
+
+	return discard_free_runs(xfat);
+}
+
 void xfat_unmount(xfat_t* xfat) {
-	save_cluster_free_info(xfat_get_disk(xfat), xfat->cluster_total_free, xfat->cluster_next_free,
-		xfat->fsi_sector, xfat->backup_sector);
-	xfat_bpool_flush(to_obj(xfat));
+	xfat_sync(xfat);
+
+	// 释放从分配器中分配的缓存内存
+	xfat_set_buf(xfat, (u8_t*)0, 0, 0, 0);
+	xfat_set_free_map(xfat, (u32_t*)0, 0);
 	xfat_list_remove(xfat);
 }
 
-xfat_err_t xfat_set_buf(xfat_t* xfat, u8_t* buf, u32_t size) {
+// 新内存与缓存池正在使用的内存是否重叠
+static int bpool_mem_overlap(xfat_bpool_t* pool, u8_t* buf, u32_t size) {
+	return (pool->size > 0) && !pool->mem_alloced && (size > 0) &&
+		(buf < pool->mem + pool->mem_size) && (pool->mem < buf + size);
+}
+
+// buf依次分给FAT表、目录及数据分区，各分区大小用XFAT_BUF_SIZE计算；分区大小为0时该类扇区缓存在数据分区中
+// buf为空时各分区从xfat_bpool_set_mem设置的分配器中分配内存
+xfat_err_t xfat_set_buf(xfat_t* xfat, u8_t* buf, u32_t fat_size, u32_t dir_size, u32_t data_size) {
 	xdisk_part_t* part = xfat->disk_part;
-	xfat_err_t err = xfat_bpool_flush_sectors(to_obj(xfat), part->start_sector, part->total_sector);
+	u32_t min_size = XFAT_BUF_SIZE(xfat_get_disk(xfat)->sector_size, 1);
+
+	// 分区由无到有或由有到无时，扇区所在的缓存池会改变，需回写并清除整个分区的缓存；否则在线调整大小
+	if (((xfat->fat_bpool.size > 0) != (fat_size >= min_size)) ||
+		((xfat->dir_bpool.size > 0) != (dir_size >= min_size)) ||
+		((xfat->bpool.size > 0) != (data_size >= min_size))) {
+		xfat_err_t err = xfat_bpool_flush_sectors(to_obj(xfat), part->start_sector, part->total_sector);
+		if (err < 0) {
+			return err;
+		}
+
+		err = xfat_bpool_invalid_sectors(to_obj(xfat), part->start_sector, part->total_sector);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	// FAT、目录、数据分区依次迁移。新的FAT或目录分区与之后才迁移的分区正在使用的内存重叠时，
+	// 初始化会覆盖其缓存链表，此时先清空各分区（回写脏缓存），再按新的划分建立
+	if (buf && (bpool_mem_overlap(&xfat->dir_bpool, buf, fat_size) ||
+		bpool_mem_overlap(&xfat->bpool, buf, fat_size + dir_size))) {
+		xfat_bpool_part_t parts[] = { XFAT_BPOOL_PART_FAT, XFAT_BPOOL_PART_DIR, XFAT_BPOOL_PART_DATA };
+		for (int i = 0; i < 3; i++) {
+			xfat_err_t err = xfat_bpool_resize(to_obj(xfat), parts[i], (u8_t*)0, 0);
+			if (err < 0) {
+				return err;
+			}
+		}
+	}
+
+	xfat_err_t err = xfat_bpool_resize(to_obj(xfat), XFAT_BPOOL_PART_FAT, buf, fat_size);
 	if (err < 0) {
 		return err;
 	}
 
-	err = xfat_bpool_invalid_sectors(to_obj(xfat), part->start_sector, part->total_sector);
+	err = xfat_bpool_resize(to_obj(xfat), XFAT_BPOOL_PART_DIR, buf ? buf + fat_size : buf, dir_size);
 	if (err < 0) {
 		return err;
 	}
 
-	return xfat_bpool_init(to_obj(xfat), xfat_get_disk(xfat)->sector_size, buf, size);
+	return xfat_bpool_resize(to_obj(xfat), XFAT_BPOOL_PART_DATA, buf ? buf + fat_size + dir_size : buf, data_size);
 }
 
 xfat_err_t xfat_fmt_ctrl_init(xfat_fmt_ctrl_t* ctrl) {
@@ -333,16 +430,16 @@ static xfat_err_t create_vol_id_label(xdisk_t* disk, dbr_t* dbr) {
 }
 
 /**
- * Ҫfat
- * @param dbr dbr
- * @param xdisk_part Ϣ
- * @param ctrl ʽƲ
- * @return ÿfatС
+ * 计算所需要的fat表扇区数
+ * @param dbr dbr分区参数
+ * @param xdisk_part 分区信息
+ * @param ctrl 格式化控制参数
+ * @return 每个fat表项大小
  */
 static u32_t cal_fat_tbl_sectors(dbr_t* dbr, xdisk_part_t* xdisk_part, xfat_fmt_ctrl_t* ctrl) {
-	//  + fat * fat +  = 
-	// fat * С / 4 =  / ÿ  
-	// fat=(-)/(FAT+С*ÿ/4)
+	// 保留区扇区数 + fat表数量 * fat表扇区数 + 数据区扇区数 = 总扇区数
+	// fat表扇区数 * 扇区大小 / 4 = 数据区扇区数 / 每簇扇区数  
+	// fat表扇区数=(总扇区数-保留区扇区数)/(FAT表数量+扇区大小*每簇扇区数/4)
 	u32_t sector_size = xdisk_part->disk->sector_size;
 	u32_t fat_dat_sectors = xdisk_part->total_sector - dbr->bpb.BPB_RsvdSecCnt;
 	u32_t fat_sector_count = fat_dat_sectors / (dbr->bpb.BPB_NumFATs + sector_size * dbr->bpb.BPB_SecPerClus / sizeof(cluster32_t));
@@ -352,7 +449,7 @@ static u32_t cal_fat_tbl_sectors(dbr_t* dbr, xdisk_part_t* xdisk_part, xfat_fmt_
 
 static u32_t get_default_cluster_size(xdisk_part_t* disk_part) {
 	u32_t sector_size = disk_part->disk->sector_size;
-	u64_t part_size = disk_part->total_sector * sector_size;
+	u64_t part_size = xdisk_part_size(disk_part);
 	u32_t cluster_size;
 
 	if (part_size <= XFAT_MB(64)) {
@@ -361,16 +458,16 @@ static u32_t get_default_cluster_size(xdisk_part_t* disk_part) {
 	else if (part_size <= XFAT_MB(128)) {
 		cluster_size = XFAT_MAX(XFAT_CLUSTER_1K, sector_size);
 	}
-	else if (sector_size <= XFAT_MB(256)) {
+	else if (part_size <= XFAT_MB(256)) {
 		cluster_size = XFAT_MAX(XFAT_CLUSTER_2K, sector_size);
 	}
-	else if (sector_size <= XFAT_GB(8)) {
+	else if (part_size <= XFAT_GB(8)) {
 		cluster_size = XFAT_MAX(XFAT_CLUSTER_4K, sector_size);
 	}
-	else if (sector_size <= XFAT_GB(16)) {
+	else if (part_size <= XFAT_GB(16)) {
 		cluster_size = XFAT_MAX(XFAT_CLUSTER_8K, sector_size);
 	}
-	else if (sector_size <= XFAT_GB(32)) {
+	else if (part_size <= XFAT_GB(32)) {
 		cluster_size = XFAT_MAX(XFAT_CLUSTER_16K, sector_size);
 	}
 	else {
@@ -381,10 +478,10 @@ static u32_t get_default_cluster_size(xdisk_part_t* disk_part) {
 }
 
 /**
- * ݷʽdbrͷ
- * @param dbr dbrͷṹ
- * @param xdisk_part ṹ
- * @param ctrl ʽ
+ * 根据分区及格式化参数，创建dbr头
+ * @param dbr dbr头结构
+ * @param xdisk_part 分区结构
+ * @param ctrl 格式化参数
  * @return
  */
 static xfat_err_t create_dbr(xdisk_part_t* xdisk_part, xfat_fmt_ctrl_t* ctrl, xfat_fmt_info_t* fmt_info) {
@@ -394,7 +491,7 @@ static xfat_err_t create_dbr(xdisk_part_t* xdisk_part, xfat_fmt_ctrl_t* ctrl, xf
 	dbr_t* dbr;
 	xfat_buf_t* buf = (xfat_buf_t*)0;
 
-	// شСشСܱСҪС
+	// 计算簇大小，簇大小不能比扇区大小要小
 	if ((u32_t)ctrl->cluster_size < disk->sector_size) {
 		return FS_ERR_PARAM;
 	}
@@ -412,54 +509,58 @@ static xfat_err_t create_dbr(xdisk_part_t* xdisk_part, xfat_fmt_ctrl_t* ctrl, xf
 	dbr = (dbr_t*)buf->buf;
 
 	memset(dbr, 0, disk->sector_size);
-	dbr->bpb.BS_jmpBoot[0] = 0xEB;          // ⼸תǱ
-	dbr->bpb.BS_jmpBoot[1] = 0x58;          // winʶΪδʽ
+	dbr->bpb.BS_jmpBoot[0] = 0xEB;          // 这几个跳转代码是必须的
+	dbr->bpb.BS_jmpBoot[1] = 0x58;          // 不加win会识别为未格式化
 	dbr->bpb.BS_jmpBoot[2] = 0x00;
 	strncpy((char*)dbr->bpb.BS_OEMName, "XFAT SYS", 8);
 	dbr->bpb.BPB_BytsPerSec = disk->sector_size;
 	dbr->bpb.BPB_SecPerClus = to_sector(disk, cluster_size);
-	dbr->bpb.BPB_RsvdSecCnt = 8478;         // ̶ֵΪ32ʵʲԣΪ6182
-	dbr->bpb.BPB_NumFATs = 2;               // ̶Ϊ2
-	dbr->bpb.BPB_RootEntCnt = 0;            // FAT32δ
-	dbr->bpb.BPB_TotSec16 = 0;              // FAT32δ
-	dbr->bpb.BPB_Media = 0xF8;              // ̶ֵ
-	dbr->bpb.BPB_FATSz16 = 0;               // FAT32δ
-	dbr->bpb.BPB_SecPerTrk = 0xFFFF;        // ֧Ӳ̽ṹ
-	dbr->bpb.BPB_NumHeads = 0xFFFF;         // ֧Ӳ̽ṹ
-	dbr->bpb.BPB_HiddSec = xdisk_part->relative_sector;    // Ƿȷ?
+	dbr->bpb.BPB_RsvdSecCnt = 8478 * 512 / disk->sector_size;  // 固定值为32，这里根据实际测试，按512字节扇区设置为8478，大扇区时保持字节数不变
+	dbr->bpb.BPB_NumFATs = 2;               // 固定为2
+	dbr->bpb.BPB_RootEntCnt = 0;            // FAT32未用
+	dbr->bpb.BPB_TotSec16 = 0;              // FAT32未用
+	dbr->bpb.BPB_Media = 0xF8;              // 固定值
+	dbr->bpb.BPB_FATSz16 = 0;               // FAT32未用
+	dbr->bpb.BPB_SecPerTrk = 0xFFFF;        // 不支持硬盘结构
+	dbr->bpb.BPB_NumHeads = 0xFFFF;         // 不支持硬盘结构
+	dbr->bpb.BPB_HiddSec = xdisk_part->relative_sector;    // 是否正确?
 	dbr->bpb.BPB_TotSec32 = xdisk_part->total_sector;
 	dbr->fat32.BPB_FATSz32 = cal_fat_tbl_sectors(dbr, xdisk_part, ctrl);
-	dbr->fat32.BPB_ExtFlags = 0;            // ̶ֵʵʱFAT
-	dbr->fat32.BPB_FSVer = 0;               // 汾ţ0
-	dbr->fat32.BPB_RootClus = 2;            // ̶Ϊ2Ϊô죿
-	dbr->fat32.BPB_FsInfo = 1;              // fsInfo
+	dbr->fat32.BPB_ExtFlags = 0;            // 固定值，实时镜像所有FAT表
+	dbr->fat32.BPB_FSVer = 0;               // 版本号，0
+	dbr->fat32.BPB_RootClus = 2;            // 固定为2，如果为坏簇怎么办？
+	dbr->fat32.BPB_FsInfo = 1;              // fsInfo的扇区号
+	dbr->fat32.BPB_BkBootSec = 6;           // 引导扇区备份的扇区号，其后为fsInfo的备份
 
 	memset(dbr->fat32.BPB_Reserved, 0, 12);
-	dbr->fat32.BS_DrvNum = 0x80;            // ̶Ϊ0
+	dbr->fat32.BS_DrvNum = 0x80;            // 固定为0
 	dbr->fat32.BS_Reserved1 = 0;
-	dbr->fat32.BS_BootSig = 0x29;           // ̶0x29
+	dbr->fat32.BS_BootSig = 0x29;           // 固定0x29
 	err = create_vol_id_label(disk, dbr);
 	if (err < 0) {
 		return err;
 	}
 	memcpy(dbr->fat32.BS_FileSysType, "FAT32   ", 8);
 
+	// 签名位于偏移510处，扇区大于512字节时扇区末尾也要写
 	((u8_t*)dbr)[510] = 0x55;
 	((u8_t*)dbr)[511] = 0xAA;
+	((u8_t*)dbr)[disk->sector_size - 2] = 0x55;
+	((u8_t*)dbr)[disk->sector_size - 1] = 0xAA;
 
 	err = xfat_bpool_write_sector(to_obj(disk), buf, 1);
 	if (err < 0) {
 		return err;
 	}
 
-	// ͬʱڱдһ
+	// 同时在备份区中写一个备份
 	buf->sector_no = xdisk_part->start_sector + dbr->fat32.BPB_BkBootSec;
 	err = xfat_bpool_write_sector(to_obj(disk), buf, 0);
 	if (err < 0) {
 		return err;
 	}
 
-	// ȡʽصĲϢռڲ
+	// 提取格式化相关的参数信息，避免占用内部缓冲区
 	fmt_info->fat_count = dbr->bpb.BPB_NumFATs;
 	fmt_info->media = dbr->bpb.BPB_Media;
 	fmt_info->fat_sectors = dbr->fat32.BPB_FATSz32;
@@ -484,47 +585,42 @@ int xfat_is_fs_supported(xfs_type_t type) {
 }
 
 /**
- * ʽFAT
- * @param dbr dbṹ
- * @param xdisk_part Ϣ
- * @param ctrl ʽ
+ * 格式化FAT表
+ * @param dbr db结构
+ * @param xdisk_part 分区信息
+ * @param ctrl 格式化参数
  * @return
  */
 static xfat_err_t create_fat_table(xfat_fmt_info_t* fmt_info, xdisk_part_t* xdisk_part, xfat_fmt_ctrl_t* ctrl) {
-	u32_t i, j;
+	u32_t i;
 	xdisk_t* disk = xdisk_part->disk;
 	xfat_err_t err = FS_ERR_OK;
 	u32_t fat_start_sector = fmt_info->rsvd_sectors + xdisk_part->start_sector;
 	xfat_buf_t* buf = (xfat_buf_t*)0;
 
+	// 所有FAT表整体清0，再单独写入各表的首扇区
+	err = xdisk_write_zeroes(disk, fat_start_sector, fmt_info->fat_sectors * fmt_info->fat_count);
+	if (err < 0) {
+		return err;
+	}
+
 	err = xfat_bpool_alloc(to_obj(disk), &buf, fat_start_sector);
 	if (err < 0) {
 		return err;
 	}
 	cluster32_t* fat_buffer = (cluster32_t*)buf->buf;
-	// дFATǹش̺鿴FAT
 	memset(fat_buffer, 0, disk->sector_size);
+
+	// 每个FAT表的前1、2簇已经被占用, 簇2分配给根目录，保留
+	fat_buffer[0].v = (u32_t)(0x0FFFFF00 | fmt_info->media);
+	fat_buffer[1].v = 0x0FFFFFFF;
+	fat_buffer[2].v = 0x0FFFFFFF;
 	for (i = 0; i < fmt_info->fat_count; i++) {
 		buf->sector_no = fat_start_sector + fmt_info->fat_sectors * i;
-
-		// ÿFATǰ12Ѿռ, 2Ŀ¼
-		fat_buffer[0].v = (u32_t)(0x0FFFFF00 | fmt_info->media);
-		fat_buffer[1].v = 0x0FFFFFFF;
-		fat_buffer[2].v = 0x0FFFFFFF;
 		err = xfat_bpool_write_sector(to_obj(disk), buf, 1);
 		if (err < 0) {
 			return err;
 		}
-
-		// дĴ
-		fat_buffer[0].v = fat_buffer[1].v = fat_buffer[2].v = 0;
-		for (j = 1; j < fmt_info->fat_sectors; j++) {
-			++buf->sector_no;
-			err = xfat_bpool_write_sector(to_obj(disk), buf, 1);
-			if (err < 0) {
-				return err;
-			}
-		}
 	}
 	return err;
 }
@@ -540,23 +636,22 @@ static xfat_err_t create_root_dir(xfat_fmt_info_t* fmt_info, xdisk_part_t* disk_
 		(fmt_info->fat_count * fmt_info->fat_sectors) +
 		(fmt_info->root_cluster - 2) * fmt_info->sec_per_cluster;
 
-	err = xfat_bpool_alloc(to_obj(disk), &buf, disk_part->start_sector + data_sector);
-	diritem = (diritem_t*)buf->buf;
+	err = xdisk_write_zeroes(disk, disk_part->start_sector + data_sector, fmt_info->sec_per_cluster);
+	if (err < 0) {
+		return err;
+	}
 
-	memset(buf->buf, 0, disk->sector_size);
-	for (u32_t i = 0; i < fmt_info->sec_per_cluster; i++) {
-		err = xfat_bpool_write_sector(to_obj(disk), buf, 1);
-		buf->sector_no++;
+	if (ctrl->vol_name) {
+		err = xfat_bpool_alloc(to_obj(disk), &buf, disk_part->start_sector + data_sector);
 		if (err < 0) {
 			return err;
 		}
-	}
+		diritem = (diritem_t*)buf->buf;
 
-	if (ctrl->vol_name) {
+		memset(buf->buf, 0, disk->sector_size);
 		diritem_init_default(diritem, disk, 0, ctrl->vol_name ? ctrl->vol_name : "DISK", 0);
 		diritem->DIR_Attr |= DIRITEM_ATTR_VOLUME_ID;
 
-		buf->sector_no = disk_part->start_sector + data_sector;
 		err = xfat_bpool_write_sector(to_obj(disk), buf, 0);
 		if (err < 0) {
 			return err;
@@ -567,9 +662,14 @@ static xfat_err_t create_root_dir(xfat_fmt_info_t* fmt_info, xdisk_part_t* disk_
 }
 
 static xfat_err_t create_fsinfo(xfat_fmt_info_t* fmt_info, xdisk_part_t* xdisk_part, xfat_fmt_ctrl_t* ctrl) {
-	u32_t total_free = fmt_info->fat_sectors * xdisk_part->disk->sector_size / sizeof(cluster32_t) - (2 + 1);
-	return save_cluster_free_info(xdisk_part->disk, total_free, 3,
-		fmt_info->fsinfo_sector, fmt_info->fsinfo_sector);
+	u32_t fat_count = fmt_info->fat_sectors * xdisk_part->disk->sector_size / sizeof(cluster32_t);
+	u32_t data_sectors = xdisk_part->total_sector - fmt_info->rsvd_sectors - fmt_info->fat_count * fmt_info->fat_sectors;
+	u32_t data_count = data_sectors / fmt_info->sec_per_cluster + 2;
+
+	// 空闲簇不包括保留的0、1号簇及根目录簇，也不包括FAT表中超出数据区的簇项
+	u32_t total_free = ((data_count < fat_count) ? data_count : fat_count) - (2 + 1);
+	return save_cluster_free_info(to_obj(xdisk_part->disk), xdisk_part->disk->sector_size, total_free, 3,
+		xdisk_part->start_sector + fmt_info->fsinfo_sector, fmt_info->backup_sector);
 }
 
 static xfat_err_t rewrite_partition_table(xdisk_part_t* disk_part, xfat_fmt_ctrl_t* ctrl) {
@@ -581,8 +681,16 @@ xfat_err_t xfat_format(xdisk_part_t* disk_part, xfat_fmt_ctrl_t* ctrl) {
 		return FS_ERR_INVALID_FS;
 	}
 
+	// 分区中原有的内容全部作废，缓存不再回写，磁盘可回收其存储空间。回收只是优化，失败时照常格式化
+	xfat_err_t err = xfat_bpool_invalid_sectors(to_obj(disk_part->disk), disk_part->start_sector, disk_part->total_sector);
+	if (err < 0) {
+		return err;
+	}
+	xdisk_discard(disk_part->disk, disk_part->start_sector, disk_part->total_sector);
+
 	xfat_fmt_info_t fmt_info;
-	u32_t err = create_dbr(disk_part, ctrl, &fmt_info);
+	memset(&fmt_info, 0, sizeof(fmt_info));
+	err = create_dbr(disk_part, ctrl, &fmt_info);
 	if (err < 0) {
 		return err;
 	}
@@ -607,10 +715,10 @@ xfat_err_t xfat_format(xdisk_part_t* disk_part, xfat_fmt_ctrl_t* ctrl) {
 	return err;
 }
 
-// ȡfatļϵͳУcluster_noصĵһ
+// 获取fat文件系统中，第cluster_no个簇的第一个扇区编号
 u32_t cluster_first_sector(xfat_t* xfat, u32_t cluster_no) {
 	u32_t data_start_sector = xfat->fat_start_sector + xfat->fat_tbl_sectors * xfat->fat_tbl_nr;
-	// ҪȥʼأʵĴغ
+	// 需要减去起始的两个保留簇，才是真实的簇号
 	return data_start_sector + (cluster_no - 2) * xfat->sec_per_cluster;
 }
 
@@ -635,35 +743,324 @@ xfat_err_t read_cluster(xfat_t* xfat, u8_t* buffer, u32_t cluster, u32_t count)
 	return FS_ERR_OK;
 }
 
+/**
+ * 回写修改后的FAT表扇区。立即模式下写穿主表及各镜像表；
+ * 延迟模式下只在缓存中更新主表，并记录镜像表待同步的范围，由xfat_sync_fat_mirror批量同步
+ */
+static xfat_err_t write_fat_sector(xfat_t* xfat, xfat_buf_t* buf) {
+	if (xfat->fat_mirror_defer && (xfat->fat_tbl_nr > 1)) {
+		u32_t tbl_sector = buf->sector_no - xfat->fat_start_sector;
+		if (xfat->mirror_dirty_start >= xfat->mirror_dirty_end) {
+			xfat->mirror_dirty_start = tbl_sector;
+			xfat->mirror_dirty_end = tbl_sector + 1;
+		}
+		else if (tbl_sector < xfat->mirror_dirty_start) {
+			xfat->mirror_dirty_start = tbl_sector;
+		}
+		else if (tbl_sector >= xfat->mirror_dirty_end) {
+			xfat->mirror_dirty_end = tbl_sector + 1;
+		}
+
+		return xfat_bpool_write_sector(to_obj(xfat), buf, 0);
+	}
+
+	xfat_err_t err = xfat_bpool_write_sector(to_obj(xfat), buf, 1);
+	if (err < 0) {
+		return err;
+	}
+
+	for (u32_t i = 1; i < xfat->fat_tbl_nr; i++) {
+		buf->sector_no += xfat->fat_tbl_sectors;
+		err = xfat_bpool_write_sector(to_obj(xfat), buf, 1);
+		if (err < 0) {
+			return err;
+		}
+	}
+	return FS_ERR_OK;
+}
+
+/**
+ * 将主FAT表中待同步范围内的扇区复制到各镜像表，每次读取一批连续扇区后对每个镜像表一次写入。
+ * 主表的这些扇区先写入并落盘，中途断电时镜像表不会比主表新
+ */
+xfat_err_t xfat_sync_fat_mirror(xfat_t* xfat) {
+	xdisk_t* disk = xfat_get_disk(xfat);
+	u32_t max_count = sizeof(fat_sync_buf) / disk->sector_size;
+
+	if (xfat->mirror_dirty_start < xfat->mirror_dirty_end) {
+		xfat_err_t err = xfat_bpool_flush_sectors(to_obj(xfat), xfat->fat_start_sector + xfat->mirror_dirty_start,
+			xfat->mirror_dirty_end - xfat->mirror_dirty_start);
+		if (err < 0) {
+			return err;
+		}
+
+		err = xdisk_sync(disk);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	while (xfat->mirror_dirty_start < xfat->mirror_dirty_end) {
+		u32_t start_sector = xfat->mirror_dirty_start;
+		u32_t count = xfat->mirror_dirty_end - start_sector;
+		if (count > max_count) {
+			count = max_count;
+		}
+
+		for (u32_t i = 0; i < count; i++) {
+			xfat_buf_t* buf = (xfat_buf_t*)0;
+			xfat_err_t err = xfat_bpool_read_sector(to_obj(xfat), &buf, xfat->fat_start_sector + start_sector + i);
+			if (err < 0) {
+				return err;
+			}
+			memcpy(fat_sync_buf + i * disk->sector_size, buf->buf, disk->sector_size);
+		}
+
+		for (u32_t i = 1; i < xfat->fat_tbl_nr; i++) {
+			u32_t mirror_sector = xfat->fat_start_sector + i * xfat->fat_tbl_sectors + start_sector;
+			xfat_err_t err = xdisk_write_sector(disk, fat_sync_buf, mirror_sector, count);
+			if (err < 0) {
+				return err;
+			}
+
+			// 立即模式下写过的镜像表扇区可能仍在缓存中，丢弃旧内容
+			err = xfat_bpool_invalid_sectors(to_obj(xfat), mirror_sector, count);
+			if (err < 0) {
+				return err;
+			}
+		}
+
+		xfat->mirror_dirty_start += count;
+	}
+
+	xfat->mirror_dirty_start = xfat->mirror_dirty_end = 0;
+	return FS_ERR_OK;
+}
+
+/**
+ * 设置FAT镜像表是否延迟同步，关闭时立即同步之前延迟的修改
+ */
+xfat_err_t xfat_set_fat_mirror_defer(xfat_t* xfat, u8_t defer) {
+	if (!defer) {
+		xfat_err_t err = xfat_sync_fat_mirror(xfat);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	xfat->fat_mirror_defer = defer;
+	return FS_ERR_OK;
+}
+
+/**
+ * 释放一段连续的簇：丢弃其在各分区中的缓存，避免旧内容被回写，并记录该簇段，待xfat_sync落盘后再回收存储空间。
+ * 与已记录的簇段相邻时合并，记录已满时不再回收
+ */
+static xfat_err_t release_cluster_run(xfat_t* xfat, u32_t start_cluster, u32_t count) {
+	u32_t start_sector = cluster_first_sector(xfat, start_cluster);
+	u32_t sector_count = count * xfat->sec_per_cluster;
+
+	if (count == 0) {
+		return FS_ERR_OK;
+	}
+
+	xfat_err_t err = xfat_bpool_invalid_sectors(to_obj(xfat), start_sector, sector_count);
+	if (err < 0) {
+		return err;
+	}
+
+	for (u32_t i = 0; i < xfat->discard_run_count; i++) {
+		xfat_cluster_run_t* run = xfat->discard_runs + i;
+		if (run->start + run->count == start_cluster) {
+			run->count += count;
+			return FS_ERR_OK;
+		}
+		else if (start_cluster + count == run->start) {
+			run->start = start_cluster;
+			run->count += count;
+			return FS_ERR_OK;
+		}
+	}
+
+	if (xfat->discard_run_count < XFAT_DISCARD_RUN_NR) {
+		xfat_cluster_run_t* run = xfat->discard_runs + xfat->discard_run_count++;
+		run->start = start_cluster;
+		run->count = count;
+	}
+	return FS_ERR_OK;
+}
+
+/**
+ * 通知磁盘回收已释放簇段的存储空间。须在FAT表及目录落盘后调用，否则断电后磁盘上仍被引用的簇可能已被回收。
+ * 期间被重新分配的簇跳过，回收只是优化，磁盘不支持时忽略
+ */
+static xfat_err_t discard_free_runs(xfat_t* xfat) {
+	for (u32_t i = 0; i < xfat->discard_run_count; i++) {
+		xfat_cluster_run_t* run = xfat->discard_runs + i;
+		u32_t start = 0, count = 0;
+
+		for (u32_t cluster = run->start; cluster <= run->start + run->count; cluster++) {
+			u8_t is_free = 0;
+
+			if (cluster < run->start + run->count) {
+				if (xfat->free_map) {
+					is_free = (xfat->free_map[cluster >> 5] >> (cluster & 31)) & 1;
+				}
+				else {
+					u32_t next_cluster;
+					xfat_err_t err = get_next_cluster(xfat, cluster, &next_cluster);
+					if (err < 0) {
+						return err;
+					}
+					is_free = next_cluster == CLUSTER_FREE;
+				}
+			}
+
+			if (is_free) {
+				if (count++ == 0) {
+					start = cluster;
+				}
+			}
+			else if (count) {
+				xdisk_discard(xfat_get_disk(xfat), cluster_first_sector(xfat, start), count * xfat->sec_per_cluster);
+				count = 0;
+			}
+		}
+	}
+
+	xfat->discard_run_count = 0;
+	return FS_ERR_OK;
+}
+
+// 有效的簇项总数，包括保留的0、1号簇。FAT表末尾可能有超出数据区的簇项，其值为0但不能分配
+static u32_t fat_cluster_count(xfat_t* xfat) {
+	u32_t fat_count = xfat->fat_tbl_sectors * xfat_get_disk(xfat)->sector_size / sizeof(cluster32_t);
+	u32_t part_sectors = xfat->total_sectors;
+	if (part_sectors > xfat->disk_part->total_sector) {
+		part_sectors = xfat->disk_part->total_sector;
+	}
+
+	u32_t data_start = cluster_first_sector(xfat, 2) - xfat->disk_part->start_sector;
+	if (data_start >= part_sectors) {
+		return 2;
+	}
+
+	u32_t data_count = (part_sectors - data_start) / xfat->sec_per_cluster + 2;
+	return (data_count < fat_count) ? data_count : fat_count;
+}
+
+static void free_map_set(xfat_t* xfat, u32_t cluster, u8_t is_free) {
+	if (xfat->free_map && ((cluster >> 5) < xfat->free_map_words)) {
+		if (is_free) {
+			xfat->free_map[cluster >> 5] |= (u32_t)1 << (cluster & 31);
+		}
+		else {
+			xfat->free_map[cluster >> 5] &= ~((u32_t)1 << (cluster & 31));
+		}
+	}
+}
+
+// 空闲簇位图所需的字节数
+u32_t xfat_free_map_size(xfat_t* xfat) {
+	return (fat_cluster_count(xfat) + 31) / 32 * sizeof(u32_t);
+}
+
+/**
+ * 设置空闲簇位图，之后分配簇时直接在位图中查找。位图在设置时扫描整个FAT表建立，
+ * 同时校正空闲簇数，大小至少为xfat_free_map_size。map为空时不再使用位图
+ */
+
+xfat_err_t xfat_set_free_map(xfat_t* xfat, u32_t* map, u32_t size) {
+	xdisk_t* disk = xfat_get_disk(xfat);
+	u32_t max_count = sizeof(fat_sync_buf) / disk->sector_size;
+	u32_t total_clusters = fat_cluster_count(xfat);
+	u32_t free_count = 0;
+	u32_t cluster = 0;
+
+	xfat->free_map = (u32_t*)0;
+	xfat->free_map_words = 0;
+	if (map == (u32_t*)0) {
+		return FS_ERR_OK;
+	}
+	if (size < xfat_free_map_size(xfat)) {
+		return FS_ERR_PARAM;
+	}
+
+	// 缓存中可能有未回写的FAT表修改，先回写再直接从磁盘成批读取
+	xfat_err_t err = xfat_bpool_flush_sectors(to_obj(xfat), xfat->fat_start_sector, xfat->fat_tbl_sectors);
+	if (err < 0) {
+		return err;
+	}
+
+	memset(map, 0, xfat_free_map_size(xfat));
+	for (u32_t sector = 0; sector < xfat->fat_tbl_sectors; sector += max_count) {
+		u32_t count = xfat->fat_tbl_sectors - sector;
+		if (count > max_count) {
+			count = max_count;
+		}
+
+		err = xdisk_read_sector(disk, fat_sync_buf, xfat->fat_start_sector + sector, count);
+		if (err < 0) {
+			return err;
+		}
+
+		cluster32_t* cluster32_buf = (cluster32_t*)fat_sync_buf;
+		for (u32_t i = count * disk->sector_size / sizeof(cluster32_t); i > 0; i--, cluster32_buf++, cluster++) {
+			if ((cluster >= 2) && (cluster < total_clusters) && (cluster32_buf->s.next == CLUSTER_FREE)) {
+				map[cluster >> 5] |= (u32_t)1 << (cluster & 31);
+				free_count++;
+			}
+		}
+	}
+
+	xfat->free_map = map;
+	xfat->free_map_words = (total_clusters + 31) / 32;
+	xfat->cluster_total_free = free_count;
+	return FS_ERR_OK;
+}
+
 static xfat_err_t destory_cluster_chain(xfat_t* xfat, u32_t cluster) {
 	u32_t curr_cluster = cluster;
+	u32_t run_start = 0, run_count = 0;
+	xfat_err_t err;
 
 	while (is_cluster_valid(curr_cluster)) {
 		xfat_buf_t* buf = (xfat_buf_t*)0;
-		xfat_err_t err = xfat_bpool_read_sector(to_obj(xfat), &buf, to_fat_sector(xfat, curr_cluster));
+		err = xfat_bpool_read_sector(to_obj(xfat), &buf, to_fat_sector(xfat, curr_cluster));
 		if (err < 0) {
 			return err;
 		}
 		cluster32_t* cluster32_buf = (cluster32_t*)(buf->buf + to_fat_offset(xfat, curr_cluster));
 		u32_t next_cluster = cluster32_buf->s.next;
 		cluster32_buf->s.next = CLUSTER_FREE;
-		err = xfat_bpool_write_sector(to_obj(xfat), buf, 1);
+		err = write_fat_sector(xfat, buf);
 		if (err < 0) {
 			return err;
 		}
+		free_map_set(xfat, curr_cluster, 1);
 
-		for (u32_t i = 0; i < xfat->fat_tbl_nr; i++) {
-			buf->sector_no += xfat->fat_tbl_sectors;
-			err = xfat_bpool_write_sector(to_obj(xfat), buf, 1);
+		// 相邻的簇合并后一起释放
+		if (run_count && (curr_cluster == run_start + run_count)) {
+			run_count++;
+		}
+		else {
+			err = release_cluster_run(xfat, run_start, run_count);
 			if (err < 0) {
 				return err;
 			}
+			run_start = curr_cluster;
+			run_count = 1;
 		}
 
 		curr_cluster = next_cluster;
 		xfat->cluster_total_free++;
 	}
 
+	err = release_cluster_run(xfat, run_start, run_count);
+	if (err < 0) {
+		return err;
+	}
+
 	if (!is_cluster_valid(xfat->cluster_next_free)) {
 		xfat->cluster_next_free = cluster;
 	}
@@ -687,6 +1084,10 @@ xfat_err_t move_cluster_pos(xfat_t* xfat, u32_t curr_cluster, u32_t curr_offset,
 	return FS_ERR_OK;
 }
 
+/**
+ * 从指定位置开始查找下一个符合type的目录项。返回的buf及diritem只在下一次访问缓存池之前有效，
+ * 之后还要使用时需用xfat_bpool_pin固定buf，或记下found_cluster/found_offset重新读取
+ */
 xfat_err_t get_next_diritem(xfat_t* xfat, u8_t type, u32_t start_cluster,
 	u32_t start_offset, u32_t* found_cluster, u32_t* found_offset,
 	u32_t* next_cluster, u32_t* next_offset, xfat_buf_t** buf, diritem_t** diritem) {
@@ -772,12 +1173,12 @@ static xfat_err_t to_sfn(char* dest_name, const char* my_name) {
 
 	memset(dest, ' ', SFN_LEN);
 
-	// ͷķָ
+	// 跳过开头的分隔符
 	while (is_path_sep(*my_name)) {
 		my_name++;
 	}
 
-	// ҵһб֮ǰַext_dotλҼ¼Ч
+	// 找到第一个斜杠之前的字符串，将ext_dot定位到那里，且记录有效长度
 	ext_dot = my_name;
 	p = my_name;
 	name_len = 0;
@@ -789,11 +1190,11 @@ static xfat_err_t to_sfn(char* dest_name, const char* my_name) {
 		name_len++;
 	}
 
-	// ļ.β˼ûչ
-	// todo: ļ?
+	// 如果文件名以.结尾，意思就是没有扩展名？
+	// todo: 长文件名处理?
 	ext_existed = (ext_dot > my_name) && (ext_dot < (my_name + name_len - 1));
 
-	// ƣַ, .ָ12ֽڣֻӦ
+	// 遍历名称，逐个复制字符, 算上.分隔符，最长12字节，如果分离符，则只应有
 	p = my_name;
 	for (i = 0; (i < SFN_LEN) && (*p != '\0') && !is_path_sep(*p); i++) {
 		if (ext_existed) {
@@ -818,7 +1219,7 @@ static xfat_err_t to_sfn(char* dest_name, const char* my_name) {
 }
 
 /**
- * sfnַǷǴдмСдΪСд
+ * 检查sfn字符串中是否是大写。如果中间有任意小写，都认为是小写
  * @param name
  * @return
  */
@@ -831,12 +1232,12 @@ static u8_t get_sfn_case_cfg(const char* sfn_name) {
 	const char* p;
 	int ext_existed;
 
-	// ͷķָ
+	// 跳过开头的分隔符
 	while (is_path_sep(*src_name)) {
 		src_name++;
 	}
 
-	// ҵһб֮ǰַext_dotλҼ¼Ч
+	// 找到第一个斜杠之前的字符串，将ext_dot定位到那里，且记录有效长度
 	ext_dot = src_name;
 	p = src_name;
 	name_len = 0;
@@ -848,12 +1249,12 @@ static u8_t get_sfn_case_cfg(const char* sfn_name) {
 		name_len++;
 	}
 
-	// ļ.β˼ûչ
-	// todo: ļ?
+	// 如果文件名以.结尾，意思就是没有扩展名？
+	// todo: 长文件名处理?
 	ext_existed = (ext_dot > src_name) && (ext_dot < (src_name + name_len - 1));
 	for (p = src_name; p < src_name + name_len; p++) {
 		if (ext_existed) {
-			if (p < ext_dot) { // ļ岿ִСдж
+			if (p < ext_dot) { // 文件名主体部分大小写判断
 				case_cfg |= islower(*p) ? DIRITEM_NTRES_BODY_LOWER : 0;
 			}
 			else if (p > ext_dot) {
@@ -944,46 +1345,115 @@ static xfat_err_t put_next_cluster(xfat_t* xfat, u32_t curr_cluster, u32_t next_
 		cluster32_t* cluster32_buf = (cluster32_t*)(buf->buf + to_fat_offset(xfat, curr_cluster));
 		cluster32_buf->s.next = next_cluster;
 
-		err = xfat_bpool_write_sector(to_obj(xfat), buf, 1);
+		err = write_fat_sector(xfat, buf);
 		if (err < 0) return err;
 
-		for (u32_t i = 1; i < xfat->fat_tbl_nr; i++) {
-			buf->sector_no += xfat->fat_tbl_sectors;
-			err = xfat_bpool_write_sector(to_obj(xfat), buf, 1);
-			if (err < 0) return err;
-		}
+		free_map_set(xfat, curr_cluster, next_cluster == CLUSTER_FREE);
 	}
 
 	return FS_ERR_OK;
 }
 
-static xfat_err_t allocate_free_cluster(xfat_t* xfat, u32_t curr_cluster, u32_t count,
-	u32_t* r_start_cluster, u32_t* r_allocated_count, u8_t en_erase, u8_t erase_data) {
-	u32_t allocated_count = 0;
-	u32_t searched_count = 0;
-	u32_t pre_cluster = curr_cluster;
-	u32_t first_free_cluster = CLUSTER_INVALID;
-
-	u32_t total_clusters = xfat->fat_tbl_sectors * xfat_get_disk(xfat)->sector_size / sizeof(cluster32_t);
-	while (xfat->cluster_total_free &&
-		(allocated_count < count) &&
-		(searched_count < total_clusters)) {
-		u32_t next_cluster;
-		xfat_err_t err = get_next_cluster(xfat, xfat->cluster_next_free, &next_cluster);
-		if (err < 0) {
-			destory_cluster_chain(xfat, curr_cluster);
-			return err;
+/**
+ * 从start_cluster起依次查找连续的空闲簇段，找到长度达到count的段即返回，否则返回找到的最长段。
+ * 有空闲簇位图时扫描整个位图，全空或全满的字一次跳过；否则逐个查FAT表，找到空闲簇后最多查XFAT_ALLOC_SCAN_MAX个簇
+ */
+static xfat_err_t find_free_run(xfat_t* xfat, u32_t start_cluster, u32_t count, u32_t* r_start, u32_t* r_count) {
+	u32_t total_clusters = fat_cluster_count(xfat);
+	u32_t scan_max = xfat->free_map ? total_clusters : XFAT_ALLOC_SCAN_MAX;
+	u32_t cluster = start_cluster;
+	u32_t run_start = 0, run_count = 0;
+	u32_t scanned = 0;
+
+	*r_start = *r_count = 0;
+	if ((cluster < 2) || (cluster >= total_clusters)) {
+		cluster = 2;
+	}
+
+	// 超出查找范围后，只要已找到空闲簇就不再继续
+	while ((scanned < total_clusters) && ((scanned < scan_max) || (*r_count == 0))) {
+		u32_t step = 1;
+		u8_t is_free;
+
+		if (xfat->free_map) {
+			u32_t word = xfat->free_map[cluster >> 5];
+			if (!(cluster & 31) && ((word == 0) || (word == ~(u32_t)0))) {
+				step = 32;
+			}
+			is_free = (word >> (cluster & 31)) & 1;
 		}
-		if (next_cluster == CLUSTER_FREE) {
-			u32_t free_cluster = xfat->cluster_next_free;
-			err = put_next_cluster(xfat, pre_cluster, free_cluster);
+		else {
+			u32_t next_cluster;
+			xfat_err_t err = get_next_cluster(xfat, cluster, &next_cluster);
 			if (err < 0) {
-				destory_cluster_chain(xfat, curr_cluster);
 				return err;
 			}
+			is_free = next_cluster == CLUSTER_FREE;
+		}
 
-			if (en_erase) {
-				err = erase_cluster(xfat, free_cluster, 0);
+		if (is_free) {
+			if (run_count == 0) {
+				run_start = cluster;
+			}
+			run_count += step;
+			if (run_count >= count) {
+				*r_start = run_start;
+				*r_count = count;
+				return FS_ERR_OK;
+			}
+			if (run_count > *r_count) {
+				*r_start = run_start;
+				*r_count = run_count;
+			}
+		}
+		else {
+			run_count = 0;
+		}
+
+		// 簇段不跨越FAT表末尾
+		cluster += step;
+		scanned += step;
+		if (cluster >= total_clusters) {
+			cluster = 2;
+			run_count = 0;
+		}
+	}
+
+	return FS_ERR_OK;
+}
+
+/**
+ * 分配count个簇并链接到curr_cluster之后。优先从curr_cluster之后查找足够长的连续空闲段，
+ * 空闲空间零碎时才由多个段拼接
+ */
+static xfat_err_t allocate_free_cluster(xfat_t* xfat, u32_t curr_cluster, u32_t count,
+	u32_t* r_start_cluster, u32_t* r_allocated_count, u8_t en_erase, u8_t erase_data) {
+	u32_t allocated_count = 0;
+	u32_t pre_cluster = curr_cluster;
+	u32_t first_free_cluster = CLUSTER_INVALID;
+	u32_t start_cluster = is_cluster_valid(curr_cluster) ? curr_cluster + 1 : xfat->cluster_next_free;
+
+	while (xfat->cluster_total_free && (allocated_count < count)) {
+		u32_t run_start, run_count;
+		xfat_err_t err = find_free_run(xfat, start_cluster, count - allocated_count, &run_start, &run_count);
+		if (err < 0) {
+			destory_cluster_chain(xfat, curr_cluster);
+			return err;
+		}
+		if (run_count == 0) {
+			break;
+		}
+
+		for (u32_t free_cluster = run_start; free_cluster < run_start + run_count; free_cluster++) {
+			err = put_next_cluster(xfat, pre_cluster, free_cluster);
+			if (err < 0) {
+				destory_cluster_chain(xfat, curr_cluster);
+				return err;
+			}
+			free_map_set(xfat, free_cluster, 0);
+
+			if (en_erase) {
+				err = erase_cluster(xfat, free_cluster, 0);
 				if (err < 0) {
 					destory_cluster_chain(xfat, curr_cluster);
 					return err;
@@ -995,16 +1465,11 @@ static xfat_err_t allocate_free_cluster(xfat_t* xfat, u32_t curr_cluster, u32_t
 			allocated_count++;
 
 			if (allocated_count == 1) {
-				first_free_cluster = xfat->cluster_next_free;
+				first_free_cluster = free_cluster;
 			}
 		}
 
-		xfat->cluster_next_free++;
-		if (xfat->cluster_next_free >= total_clusters) {
-			xfat->cluster_next_free = 0;
-		}
-
-		searched_count++;
+		start_cluster = xfat->cluster_next_free = run_start + run_count;
 	}
 
 	if (allocated_count) {
@@ -1093,7 +1558,7 @@ static void copy_file_info(xfileinfo_t* info, const diritem_t* dir_item) {
 }
 
 /**
- * ļǷƥ
+ * 检查文件名和类型是否匹配
  * @param dir_item
  * @param locate_type
  * @return
@@ -1102,18 +1567,18 @@ static u8_t is_locate_type_match(diritem_t* dir_item, u8_t locate_type) {
 	u8_t match = 1;
 
 	if ((dir_item->DIR_Attr & DIRITEM_ATTR_SYSTEM) && !(locate_type & XFILE_LOCATE_SYSTEM)) {
-		match = 0;  // ʾϵͳļ
+		match = 0;  // 不显示系统文件
 	}
 	else if ((dir_item->DIR_Attr & DIRITEM_ATTR_HIDDEN) && !(locate_type & XFILE_LOCATE_HIDDEN)) {
-		match = 0;  // ʾļ
+		match = 0;  // 不显示隐藏文件
 	}
 	else if ((dir_item->DIR_Attr & DIRITEM_ATTR_VOLUME_ID) && !(locate_type & XFILE_LOCATE_VOL)) {
-		match = 0;  // ʾ
+		match = 0;  // 不显示卷标
 	}
 	else if ((memcmp(DOT_FILE, dir_item->DIR_Name, SFN_LEN) == 0)
 		|| (memcmp(DOT_DOT_FILE, dir_item->DIR_Name, SFN_LEN) == 0)) {
 		if (!(locate_type & XFILE_LOCATE_DOT)) {
-			match = 0;// ʾdotļ
+			match = 0;// 不显示dot文件
 		}
 	}
 	else if (!(locate_type & XFILE_LOCATE_NORMAL)) {
@@ -1186,7 +1651,7 @@ static xfat_err_t open_sub_file(xfat_t* xfat, u32_t dir_cluster, xfile_t* file,
 
 	xfat_obj_init(to_obj(file), XFAT_OBJ_FILE);
 
-	xfat_err_t err = xfat_bpool_init(&file->obj, 0, 0, 0);
+	xfat_err_t err = xfat_bpool_init(&file->obj, 0, 0, 0, XFAT_BPOOL_LRU);
 	if (err < 0) {
 		return err;
 	}
@@ -1241,6 +1706,14 @@ static xfat_err_t open_sub_file(xfat_t* xfat, u32_t dir_cluster, xfile_t* file,
 	file->xfat = xfat;
 	file->pos = 0;
 	file->err = FS_ERR_OK;
+	file->ra_last_pos = 0;
+	file->ra_end = 0;
+	file->ra_window = 0;
+	file->prealloc_clusters = 0;
+	file->delay_buf = (u8_t*)0;
+	file->delay_size = file->delay_len = 0;
+	file->extents = (xfile_extent_t*)0;
+	file->extent_max = file->extent_cnt = 0;
 	file->attr = 0;
 
 	return FS_ERR_OK;
@@ -1280,25 +1753,77 @@ xfat_err_t xfile_open_sub(xfile_t* dir, const char* sub_path, xfile_t* sub_file)
 	return open_sub_file(dir->xfat, dir->start_cluster, sub_file, sub_path);
 }
 
+static xfat_err_t flush_delay_buf(xfile_t* file);
+
+/**
+ * 回写文件暂存及独立缓存中的数据，再同步文件所在的文件系统
+ */
+xfat_err_t xfile_sync(xfile_t* file) {
+	xfat_err_t err = flush_delay_buf(file);
+	if (err < 0) {
+		return err;
+	}
+
+	err = xfat_bpool_flush(to_obj(file));
+	if (err < 0) {
+		return err;
+	}
+	return xfat_sync(file->xfat);
+}
+
 xfat_err_t xfile_close(xfile_t* file) {
+	xfat_err_t err = flush_delay_buf(file);
+	if (err < 0) {
+		return err;
+	}
+
+	// 释放未用到的预分配簇
+	if (file->prealloc_clusters) {
+		err = xfile_fallocate(file, 0, XFILE_FALLOC_RELEASE);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	// 回写文件独立缓存中的数据，并释放从分配器中分配的内存
+	if (file->bpool.size > 0) {
+		return xfat_bpool_resize(to_obj(file), XFAT_BPOOL_PART_DATA, (u8_t*)0, 0);
+	}
 	return FS_ERR_OK;
 }
 
+// buf为空时从xfat_bpool_set_mem设置的分配器中分配内存
 xfat_err_t xfile_set_buf(xfile_t* file, u8_t* buf, u32_t size) {
 	xfat_t* xfat = file->xfat;
-	xdisk_part_t* part = xfat->disk_part;
 
-	xfat_err_t err = xfat_bpool_flush_sectors(to_obj(xfat), part->start_sector, part->total_sector);
+	xfat_err_t err = flush_delay_buf(file);
 	if (err < 0) {
 		return err;
 	}
 
-	err = xfat_bpool_invalid_sectors(to_obj(xfat), part->start_sector, part->total_sector);
-	if (err < 0) {
-		return err;
+	// 首次使用独立缓存时，文件数据可能还缓存在卷中，回写并清除这些簇的缓存
+	if ((file->bpool.size == 0) && (size >= XFAT_BUF_SIZE(xfat_get_disk(xfat)->sector_size, 1))) {
+		u32_t curr_cluster = file->start_cluster;
+		while (is_cluster_valid(curr_cluster)) {
+			u32_t start_sector = cluster_first_sector(xfat, curr_cluster);
+			xfat_err_t err = xfat_bpool_flush_sectors(to_obj(xfat), start_sector, xfat->sec_per_cluster);
+			if (err < 0) {
+				return err;
+			}
+
+			err = xfat_bpool_invalid_sectors(to_obj(xfat), start_sector, xfat->sec_per_cluster);
+			if (err < 0) {
+				return err;
+			}
+
+			err = get_next_cluster(xfat, curr_cluster, &curr_cluster);
+			if (err < 0) {
+				return err;
+			}
+		}
 	}
 
-	return xfat_bpool_init(to_obj(file), xfat_get_disk(xfat)->sector_size, buf, size);
+	return xfat_bpool_resize(to_obj(file), XFAT_BPOOL_PART_DATA, buf, size);
 }
 
 xfat_err_t xdir_first_file(xfile_t* file, xfileinfo_t* info) {
@@ -1356,31 +1881,234 @@ void xfile_clear_err(xfile_t* file) {
 	file->err = FS_ERR_OK;
 }
 
+/**
+ * 将簇链中第index簇加入区段映射，与最后一段相连时并入该段。映射已满或不再是簇链的前缀时返回0
+ */
+static int extent_map_add(xfile_t* file, u32_t index, u32_t cluster) {
+	xfile_extent_t* last = file->extent_cnt ? file->extents + file->extent_cnt - 1 : (xfile_extent_t*)0;
+	u32_t next_index = last ? last->index + last->count : 0;
+
+	if (index != next_index) {
+		return 0;
+	}
+
+	if (last && (last->cluster + last->count == cluster)) {
+		last->count++;
+		return 1;
+	}
+
+	if (file->extent_cnt >= file->extent_max) {
+		return 0;
+	}
+
+	last = file->extents + file->extent_cnt++;
+	last->index = index;
+	last->cluster = cluster;
+	last->count = 1;
+	return 1;
+}
+
+// 簇链只保留前keep_count簇后，丢弃映射中超出的部分
+static void extent_map_cut(xfile_t* file, u32_t keep_count) {
+	while (file->extent_cnt) {
+		xfile_extent_t* last = file->extents + file->extent_cnt - 1;
+		if (last->index >= keep_count) {
+			file->extent_cnt--;
+			continue;
+		}
+
+		if (last->index + last->count > keep_count) {
+			last->count = keep_count - last->index;
+		}
+		break;
+	}
+}
+
+/**
+ * 取文件簇链中第index簇(从0开始)的簇号，超出簇链时为CLUSTER_INVALID。run_count不为空时，
+ * 返回映射中从该簇起物理连续的簇数，该簇不在映射中时为0
+ */
+static xfat_err_t file_cluster_at(xfile_t* file, u32_t index, u32_t* cluster, u32_t* run_count) {
+	u32_t curr_index = 0;
+	u32_t curr_cluster = file->start_cluster;
+	int mapping = file->extents != (xfile_extent_t*)0;
+	xfat_err_t err;
+
+	if (file->extent_cnt) {
+		xfile_extent_t* last = file->extents + file->extent_cnt - 1;
+		curr_index = last->index + last->count;
+		if (index >= curr_index) {
+			err = get_next_cluster(file->xfat, last->cluster + last->count - 1, &curr_cluster);
+			if (err < 0) {
+				return err;
+			}
+		}
+	}
+
+	// 未映射到的部分沿簇链查找：启用映射时补全到簇链末尾，映射已满后只找到index为止
+	if (index >= curr_index) {
+		while (is_cluster_valid(curr_cluster)) {
+			if (mapping) {
+				mapping = extent_map_add(file, curr_index, curr_cluster);
+			}
+			if (!mapping && (curr_index >= index)) {
+				break;
+			}
+
+			err = get_next_cluster(file->xfat, curr_cluster, &curr_cluster);
+			if (err < 0) {
+				return err;
+			}
+			curr_index++;
+		}
+	}
+
+	if (file->extent_cnt) {
+		xfile_extent_t* last = file->extents + file->extent_cnt - 1;
+		if (index < last->index + last->count) {
+			// 二分查找index所在的区段
+			u32_t low = 0, high = file->extent_cnt - 1;
+			while (low < high) {
+				u32_t mid = (low + high + 1) / 2;
+				if (file->extents[mid].index <= index) {
+					low = mid;
+				}
+				else {
+					high = mid - 1;
+				}
+			}
+
+			xfile_extent_t* extent = file->extents + low;
+			*cluster = extent->cluster + (index - extent->index);
+			if (run_count) {
+				*run_count = extent->count - (index - extent->index);
+			}
+			return FS_ERR_OK;
+		}
+	}
+
+	*cluster = (is_cluster_valid(curr_cluster) && (curr_index == index)) ? curr_cluster : CLUSTER_INVALID;
+	if (run_count) {
+		*run_count = 0;
+	}
+	return FS_ERR_OK;
+}
+
+/**
+ * 设置文件的簇链区段映射。首次定位时沿簇链建立映射，之后的定位、截断和跨簇读写在映射中二分查找簇号。
+ * 缓冲区放不下全部区段时只映射簇链的前面部分，其余部分仍沿簇链查找。extents为空时不使用映射
+ */
+xfat_err_t xfile_set_extent_map(xfile_t* file, xfile_extent_t* extents, u32_t size) {
+	if (file->type != FAT_FILE) {
+		return FS_ERR_PARAM;
+	}
+
+	file->extent_max = extents ? size / sizeof(xfile_extent_t) : 0;
+	file->extents = file->extent_max ? extents : (xfile_extent_t*)0;
+	file->extent_cnt = 0;
+	return FS_ERR_OK;
+}
+
 static xfat_err_t move_file_pos(xfile_t* file, u32_t move_bytes) {
 	u32_t to_move = move_bytes;
-	u32_t cluster_offset;
 
-	// ҪļĴС
+	// 不要超过文件的大小
 	if (file->pos + move_bytes >= file->size) {
 		to_move = file->size - file->pos;
 	}
 
-	// ؼƶҪ
-	cluster_offset = to_cluster_offset(file->xfat, file->pos);
-	if (cluster_offset + to_move >= file->xfat->cluster_byte_size) {
-		u32_t curr_cluster = file->curr_cluster;
-		xfat_err_t err = get_next_cluster(file->xfat, curr_cluster, &curr_cluster);
-		if (err != FS_ERR_OK) {
-			file->err = err;
+	// 一次读写可能跨过多个簇，逐簇调整
+	while (to_move > 0) {
+		u32_t cluster_offset = to_cluster_offset(file->xfat, file->pos);
+		u32_t curr_move = file->xfat->cluster_byte_size - cluster_offset;
+		if (curr_move > to_move) {
+			curr_move = to_move;
+		}
+
+		// 簇间移动调整，需要调整簇
+		if (cluster_offset + curr_move >= file->xfat->cluster_byte_size) {
+			u32_t curr_cluster = file->curr_cluster;
+			xfat_err_t err;
+			if (file->extents) {
+				err = file_cluster_at(file, to_cluster(file->xfat, file->pos + curr_move), &curr_cluster, (u32_t*)0);
+			}
+			else {
+				err = get_next_cluster(file->xfat, curr_cluster, &curr_cluster);
+			}
+			if (err != FS_ERR_OK) {
+				file->err = err;
+				return err;
+			}
+
+			if (is_cluster_valid(curr_cluster)) {
+				file->curr_cluster = curr_cluster;
+			}
+		}
+
+		file->pos += curr_move;
+		to_move -= curr_move;
+	}
+
+	return FS_ERR_OK;
+}
+
+/**
+ * 从cluster开始沿簇链统计物理上相邻的簇，最多max_count个，跨簇的大块读写可合并为一次磁盘访问
+ */
+static xfat_err_t get_contiguous_cluster_count(xfat_t* xfat, u32_t cluster, u32_t max_count, u32_t* count) {
+	u32_t r_count = 1;
+	while (r_count < max_count) {
+		u32_t next_cluster;
+		xfat_err_t err = get_next_cluster(xfat, cluster, &next_cluster);
+		if (err < 0) {
 			return err;
 		}
+		if (next_cluster != cluster + 1) {
+			break;
+		}
+
+		cluster = next_cluster;
+		r_count++;
+	}
+
+	*count = r_count;
+	return FS_ERR_OK;
+}
 
-		if (is_cluster_valid(curr_cluster)) {
-			file->curr_cluster = curr_cluster;
+// 将从当前位置开始的sector_count个扇区限制在物理上连续的簇内
+static xfat_err_t file_contiguous_sectors(xfile_t* file, u32_t cluster_sector, u32_t* sector_count) {
+	xfat_t* xfat = file->xfat;
+	if (cluster_sector + *sector_count <= xfat->sec_per_cluster) {
+		return FS_ERR_OK;
+	}
+
+	u32_t max_count = (cluster_sector + *sector_count + xfat->sec_per_cluster - 1) / xfat->sec_per_cluster;
+	u32_t cluster_count = 0;
+	xfat_err_t err;
+	if (file->extents) {
+		u32_t cluster;
+		err = file_cluster_at(file, to_cluster(xfat, file->pos), &cluster, &cluster_count);
+		if (err < 0) {
+			return err;
+		}
+		if (cluster != file->curr_cluster) {
+			cluster_count = 0;
+		}
+		else if (cluster_count > max_count) {
+			cluster_count = max_count;
 		}
 	}
 
-	file->pos += to_move;
+	if (cluster_count == 0) {
+		err = get_contiguous_cluster_count(xfat, file->curr_cluster, max_count, &cluster_count);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	if (cluster_sector + *sector_count > cluster_count * xfat->sec_per_cluster) {
+		*sector_count = cluster_count * xfat->sec_per_cluster - cluster_sector;
+	}
 	return FS_ERR_OK;
 }
 
@@ -1427,6 +2155,7 @@ static xfat_err_t create_sub_file(xfat_t* xfat, u8_t is_dir, u32_t parent_cluste
 	u32_t free_item_offset = 0;
 	u32_t file_diritem_sector;
 	xfat_buf_t* buf = (xfat_buf_t*)0;
+	u8_t end_pinned = 0;
 
 	do {
 		diritem_t* diritem = (diritem_t*)0;
@@ -1442,12 +2171,14 @@ static xfat_err_t create_sub_file(xfat_t* xfat, u8_t is_dir, u32_t parent_cluste
 		}
 
 		if (diritem->DIR_Name[0] == DIRITEM_NAME_END) {
+			// 分配簇时会访问其它扇区，尽量固定该缓存以便之后直接写入结束项
 			target_item = diritem;
+			end_pinned = (xfat_bpool_pin(to_obj(xfat), buf) == FS_ERR_OK);
 			break;
 		}
 		else if (diritem->DIR_Name[0] == DIRITEM_NAME_FREE) {
-			// , Ҫ飬Ƿͬ
-			// ¼λ
+			// 空闲项, 还要继续检查，看是否有同名项
+			// 记录空闲项的位置
 			if (!is_cluster_valid(free_item_cluster)) {
 				free_item_cluster = curr_cluster;
 				free_item_offset = curr_offset;
@@ -1472,13 +2203,15 @@ static xfat_err_t create_sub_file(xfat_t* xfat, u8_t is_dir, u32_t parent_cluste
 	if (is_dir && strncmp(".", child_name, 1) && strncmp("..", child_name, 2)) {
 		u32_t cluster_count;
 		xfat_err_t err = allocate_free_cluster(xfat, CLUSTER_INVALID, 1, &file_first_cluster, &cluster_count, 1, 0);
+		if ((err >= 0) && (cluster_count < 1)) {
+			err = FS_ERR_DISK_FULL;
+		}
 		if (err < 0) {
+			if (end_pinned) {
+				xfat_bpool_unpin(to_obj(xfat), buf);
+			}
 			return err;
 		}
-		if (cluster_count < 1) {
-			return FS_ERR_DISK_FULL;
-		}
-
 	}
 	else {
 		file_first_cluster = *file_cluster;
@@ -1496,7 +2229,7 @@ static xfat_err_t create_sub_file(xfat_t* xfat, u8_t is_dir, u32_t parent_cluste
 			return FS_ERR_DISK_FULL;
 		}
 
-		// ȡ½еĵһȡtarget_item
+		// 读取新建簇中的第一个扇区，获取target_item
 		file_diritem_sector = cluster_first_sector(xfat, parent_diritem_cluster);
 		err = xfat_bpool_read_sector(to_obj(xfat), &buf, file_diritem_sector);
 		if (err < 0) {
@@ -1505,7 +2238,15 @@ static xfat_err_t create_sub_file(xfat_t* xfat, u8_t is_dir, u32_t parent_cluste
 
 		target_item = (diritem_t*)buf->buf;
 	}
+	else if (end_pinned && !is_cluster_valid(free_item_cluster)) {
+		// 结束项所在缓存一直被固定，无需重新读取
+		xfat_bpool_unpin(to_obj(xfat), buf);
+	}
 	else {
+		if (end_pinned) {
+			xfat_bpool_unpin(to_obj(xfat), buf);
+		}
+
 		u32_t diritem_offset;
 		if (is_cluster_valid(free_item_cluster)) {
 			file_diritem_sector = cluster_first_sector(xfat, free_item_cluster) + to_sector(disk, free_item_offset);
@@ -1646,12 +2387,12 @@ xfat_err_t xfile_rmfile(const char* path) {
 				return err;
 			}
 
-			if (diritem == (diritem_t*)0) {    // ѾĿ¼
+			if (diritem == (diritem_t*)0) {    // 已经搜索到目录结束
 				return FS_ERR_NONE;
 			}
 
 			if (is_filename_match((const char*)diritem->DIR_Name, curr_path)) {
-				// ҵȽһĿ¼
+				// 找到，比较下一级子目录
 				if (get_child_path(curr_path)) {
 					curr_cluster = get_diritem_cluster(diritem);
 					curr_offset = 0;
@@ -1669,6 +2410,8 @@ xfat_err_t xfile_rmfile(const char* path) {
 			return FS_ERR_PARAM;
 		}
 
+		// 写入后diritem所在缓存可能被换出，先取出簇号
+		u32_t diritem_cluster = get_diritem_cluster(diritem);
 		u32_t dir_sector = to_phy_sector(xfat, found_cluster, found_offset);
 		diritem->DIR_Name[0] = DIRITEM_NAME_FREE;
 
@@ -1677,7 +2420,7 @@ xfat_err_t xfile_rmfile(const char* path) {
 			return err;
 		}
 
-		err = destory_cluster_chain(xfat, get_diritem_cluster(diritem));
+		err = destory_cluster_chain(xfat, diritem_cluster);
 		if (err < 0) {
 			return err;
 		}
@@ -1702,7 +2445,7 @@ static xfat_err_t dir_has_child(xfat_t* xfat, u32_t dir_cluster, int* has_child)
 			return err;
 		}
 
-		if (diritem == (diritem_t*)0) {    // ѾĿ¼
+		if (diritem == (diritem_t*)0) {    // 已经搜索到目录结束
 			return FS_ERR_OK;
 		}
 
@@ -1743,12 +2486,12 @@ xfat_err_t xfile_rmdir(const char* path) {
 				return err;
 			}
 
-			if (diritem == (diritem_t*)0) {    // ѾĿ¼
+			if (diritem == (diritem_t*)0) {    // 已经搜索到目录结束
 				return FS_ERR_NONE;
 			}
 
 			if (is_filename_match((const char*)diritem->DIR_Name, curr_path)) {
-				// ҵȽһĿ¼
+				// 找到，比较下一级子目录
 				if (get_child_path(curr_path)) {
 					curr_cluster = get_diritem_cluster(diritem);
 					curr_offset = 0;
@@ -1766,8 +2509,13 @@ xfat_err_t xfile_rmdir(const char* path) {
 			return FS_ERR_PARAM;
 		}
 
+		// 检查子目录时会读取其它扇区，尽量固定目录项所在缓存，固定失败时之后重新读取
 		int has_child;
+		u8_t pinned = (xfat_bpool_pin(to_obj(xfat), buf) == FS_ERR_OK);
 		xfat_err_t err = dir_has_child(xfat, get_diritem_cluster(diritem), &has_child);
+		if (pinned) {
+			xfat_bpool_unpin(to_obj(xfat), buf);
+		}
 		if (err < 0) {
 			return err;
 		}
@@ -1776,12 +2524,15 @@ xfat_err_t xfile_rmdir(const char* path) {
 			return FS_ERR_NOT_EMPTY;
 		}
 
-		u32_t dir_sector = to_phy_sector(xfat, found_cluster, found_offset);
-		err = xfat_bpool_read_sector(to_obj(xfat), &buf, dir_sector);
-		if (err < 0) {
-			return err;
+		if (!pinned) {
+			u32_t dir_sector = to_phy_sector(xfat, found_cluster, found_offset);
+			err = xfat_bpool_read_sector(to_obj(xfat), &buf, dir_sector);
+			if (err < 0) {
+				return err;
+			}
+			diritem = (diritem_t*)(buf->buf + to_sector_offset(xfat_get_disk(xfat), found_offset));
 		}
-		diritem = (diritem_t*)(buf->buf + to_sector_offset(xfat_get_disk(xfat), found_offset));
+		u32_t diritem_cluster = get_diritem_cluster(diritem);
 		diritem->DIR_Name[0] = DIRITEM_NAME_FREE;
 
 		err = xfat_bpool_write_sector(to_obj(xfat), buf, 0);
@@ -1789,7 +2540,7 @@ xfat_err_t xfile_rmdir(const char* path) {
 			return err;
 		}
 
-		err = destory_cluster_chain(xfat, get_diritem_cluster(diritem));
+		err = destory_cluster_chain(xfat, diritem_cluster);
 		if (err < 0) {
 			return err;
 		}
@@ -1815,7 +2566,7 @@ static xfat_err_t rmdir_all_children(xfat_t* xfat, u32_t parent_cluster) {
 			return err;
 		}
 
-		if (diritem == (diritem_t*)0) {    // ѾĿ¼
+		if (diritem == (diritem_t*)0) {    // 已经搜索到目录结束
 			return FS_ERR_OK;
 		}
 
@@ -1824,7 +2575,9 @@ static xfat_err_t rmdir_all_children(xfat_t* xfat, u32_t parent_cluster) {
 		}
 
 		if (is_locate_type_match(diritem, XFILE_LOCATE_NORMAL)) {
+			// 递归删除时会读取其它扇区，diritem随时可能失效，先取出需要的信息
 			u32_t diritem_cluster = get_diritem_cluster(diritem);
+			u8_t is_dir = get_file_type(diritem) == FAT_DIR;
 			u32_t dir_sector = to_phy_sector(xfat, found_cluster, found_offset);
 
 			diritem->DIR_Name[0] = DIRITEM_NAME_FREE;
@@ -1833,7 +2586,7 @@ static xfat_err_t rmdir_all_children(xfat_t* xfat, u32_t parent_cluster) {
 				return err;
 			}
 
-			if (get_file_type(diritem) == FAT_DIR) {
+			if (is_dir) {
 				err = rmdir_all_children(xfat, diritem_cluster);
 				if (err < 0) {
 					return err;
@@ -1878,12 +2631,12 @@ xfat_err_t xfile_rmdir_tree(const char* path) {
 				return err;
 			}
 
-			if (diritem == (diritem_t*)0) {    // ѾĿ¼
+			if (diritem == (diritem_t*)0) {    // 已经搜索到目录结束
 				return FS_ERR_NONE;
 			}
 
 			if (is_filename_match((const char*)diritem->DIR_Name, curr_path)) {
-				// ҵȽһĿ¼
+				// 找到，比较下一级子目录
 				if (get_child_path(curr_path)) {
 					curr_cluster = get_diritem_cluster(diritem);
 					curr_offset = 0;
@@ -1925,6 +2678,98 @@ xfat_err_t xfile_rmdir_tree(const char* path) {
 	return FS_ERR_NONE;
 }
 
+// 顺序读时沿簇链预读后续扇区到缓存中，窗口在顺序读时翻倍，随机读时减半
+static xfat_err_t file_readahead(xfile_t* file, xfile_size_t bytes_to_read) {
+	xfat_t* xfat = file->xfat;
+	xdisk_t* disk = file_get_disk(file);
+
+	if (file->pos == file->ra_last_pos) {
+		file->ra_window = file->ra_window ? file->ra_window * 2 : XFILE_RA_MIN_SECTORS;
+		if (file->ra_window > XFILE_RA_MAX_SECTORS) {
+			file->ra_window = XFILE_RA_MAX_SECTORS;
+		}
+	}
+	else {
+		file->ra_window /= 2;
+		file->ra_end = 0;
+	}
+	file->ra_last_pos = file->pos + bytes_to_read;
+
+	// 大块读取直接读磁盘，无需预读；已预读的范围内也不需要
+	if ((file->ra_window == 0) || (bytes_to_read >= xfat->cluster_byte_size)
+		|| (file->pos + bytes_to_read <= file->ra_end)) {
+		return FS_ERR_OK;
+	}
+
+	u32_t ra_start = file->pos - to_sector_offset(disk, file->pos);
+	if (file->ra_end > ra_start) {
+		ra_start = file->ra_end;
+	}
+
+	u32_t ra_end = ra_start + file->ra_window * disk->sector_size;
+	if (ra_end < file->pos + bytes_to_read) {
+		ra_end = file->pos + bytes_to_read;
+	}
+	// 预读的扇区不能多于缓存池能容纳的数量，否则会相互挤出
+	u32_t ra_max = xfat_bpool_prefetch_max(to_obj(file)) * disk->sector_size;
+	if (ra_end > ra_start + ra_max) {
+		ra_end = ra_start + ra_max;
+	}
+	if (ra_end > file->size) {
+		ra_end = file->size;
+	}
+	if (ra_start >= ra_end) {
+		return FS_ERR_OK;
+	}
+
+	// 从当前簇沿簇链找到预读起始位置所在的簇
+	u32_t curr_cluster = file->curr_cluster;
+	u32_t cluster_count = ra_start / xfat->cluster_byte_size - file->pos / xfat->cluster_byte_size;
+	if (file->extents && cluster_count) {
+		xfat_err_t err = file_cluster_at(file, to_cluster(xfat, ra_start), &curr_cluster, (u32_t*)0);
+		if (err < 0) {
+			return err;
+		}
+		cluster_count = 0;
+	}
+	while (cluster_count-- > 0) {
+		xfat_err_t err = get_next_cluster(xfat, curr_cluster, &curr_cluster);
+		if (err < 0) {
+			return err;
+		}
+		if (!is_cluster_valid(curr_cluster)) {
+			return FS_ERR_OK;
+		}
+	}
+
+	u32_t pos = ra_start;
+	while ((pos < ra_end) && is_cluster_valid(curr_cluster)) {
+		u32_t cluster_sector = to_sector(disk, to_cluster_offset(xfat, pos));
+		u32_t sector_count = to_sector(disk, ra_end - pos + disk->sector_size - 1);
+		if (cluster_sector + sector_count > xfat->sec_per_cluster) {
+			sector_count = xfat->sec_per_cluster - cluster_sector;
+		}
+
+		u32_t start_sector = cluster_first_sector(xfat, curr_cluster) + cluster_sector;
+		xfat_err_t err = xfat_bpool_prefetch(to_obj(file), start_sector, sector_count);
+		if (err < 0) {
+			return err;
+		}
+
+		pos += sector_count * disk->sector_size;
+		if (cluster_sector + sector_count >= xfat->sec_per_cluster) {
+			err = get_next_cluster(xfat, curr_cluster, &curr_cluster);
+			if (err < 0) {
+				return err;
+			}
+		}
+	}
+
+	// 预读请求批量提交，在此一并等待完成，之后绕过缓存池的直接读写不会与其交错
+	file->ra_end = pos;
+	return xfat_bpool_wait(to_obj(file));
+}
+
 xfile_size_t xfile_read(void* buffer, xfile_size_t elem_size, xfile_size_t count, xfile_t* file) {
 	xfile_size_t bytes_to_read = count * elem_size;
 	u8_t* read_buffer = (u8_t*)buffer;
@@ -1934,6 +2779,12 @@ xfile_size_t xfile_read(void* buffer, xfile_size_t elem_size, xfile_size_t count
 		return 0;
 	}
 
+	xfat_err_t err = flush_delay_buf(file);
+	if (err < 0) {
+		file->err = err;
+		return 0;
+	}
+
 	if (file->pos >= file->size) {
 		file->err = FS_ERR_EOF;
 		return 0;
@@ -1946,29 +2797,31 @@ xfile_size_t xfile_read(void* buffer, xfile_size_t elem_size, xfile_size_t count
 	xdisk_t* disk = file_get_disk(file);
 	xfile_size_t r_count_readed = 0;
 
+	// 预读失败不影响本次读取，未命中的扇区仍会逐个读取
+	file_readahead(file, bytes_to_read);
+
 	while ((bytes_to_read > 0) && is_cluster_valid(file->curr_cluster)) {
 		xfat_err_t err;
 		xfile_size_t curr_read_bytes = 0;
 		u32_t sector_count = 0;
-		// ǰcurr_clusterе
+		// 当前处于curr_cluster中的扇区编号
 		u32_t cluster_sector = to_sector(disk, to_cluster_offset(file->xfat, file->pos));
-		// ǰһеһbyte
+		// 点前处于一个扇区中的哪一个byte
 		u32_t sector_offset = to_sector_offset(disk, file->pos);
 
-		// ǰfatļϵͳеһ
+		// 当前处于fat文件系统中的哪一个扇区
 		u32_t start_sector = cluster_first_sector(file->xfat, file->curr_cluster) + cluster_sector;
-		// 1) ȡ߽粻ģȶȡһֱ֤߽
-		// 2) ߽ģǶȡݴССһҲ߼
-		if ((sector_offset != 0) || (!sector_offset && (bytes_to_read < disk->sector_size))) {
+		// 1) 如果读取的左边界不是扇区对齐的，先读取玩第一部分保证其左边界扇区对齐
+		// 2) 如果左边界是扇区对齐的，但是读取的内容大小小于一个扇区则也可以走这个逻辑
+		// 3) 已预读到缓存中的扇区，也从缓存中读取
+		if ((sector_offset != 0) || (bytes_to_read < disk->sector_size) || (file->pos < file->ra_end)) {
 
 			sector_count = 1;
 			curr_read_bytes = bytes_to_read;
 
-			if (sector_offset != 0) {
-				// ȶȡݵһֱ֤߽ܹ
-				if (sector_offset + bytes_to_read > disk->sector_size) {
-					curr_read_bytes = disk->sector_size - sector_offset;
-				}
+			// 先读取内容的一部分保证左边界能够扇区对齐
+			if (sector_offset + bytes_to_read > disk->sector_size) {
+				curr_read_bytes = disk->sector_size - sector_offset;
 			}
 
 			xfat_buf_t* buf = (xfat_buf_t*)0;
@@ -1984,11 +2837,13 @@ xfile_size_t xfile_read(void* buffer, xfile_size_t elem_size, xfile_size_t count
 		}
 		else {
 			sector_count = to_sector(disk, bytes_to_read);
-			if ((cluster_sector + sector_count) > file->xfat->sec_per_cluster) {
-				sector_count = file->xfat->sec_per_cluster - cluster_sector;
+			err = file_contiguous_sectors(file, cluster_sector, &sector_count);
+			if (err < 0) {
+				file->err = err;
+				return r_count_readed / elem_size;
 			}
 
-			err = xfat_bpool_flush_sectors(to_obj(file), start_sector, count);
+			err = xfat_bpool_flush_sectors(to_obj(file), start_sector, sector_count);
 			if (err < 0) {
 				return err;
 			}
@@ -2018,7 +2873,7 @@ static xfat_err_t update_file_size(xfile_t* file, xfile_size_t size) {
 	u32_t sector = to_phy_sector(file->xfat, file->dir_cluster, file->dir_cluster_offset);
 	u32_t offset = to_sector_offset(disk, file->dir_cluster_offset);
 	xfat_buf_t* buf = (xfat_buf_t*)0;
-	xfat_err_t err = xfat_bpool_read_sector(to_obj(file), &buf, sector);
+	xfat_err_t err = xfat_bpool_read_sector(to_obj(file->xfat), &buf, sector);
 	if (err < 0) {
 		file->err = err;
 		return err;
@@ -2027,7 +2882,7 @@ static xfat_err_t update_file_size(xfile_t* file, xfile_size_t size) {
 	diritem_t* diritem = (diritem_t*)(buf->buf + offset);
 	diritem->DIR_FileSize = size;
 	set_diritem_cluster(diritem, file->start_cluster);
-	err = xfat_bpool_write_sector(to_obj(file), buf, 0);
+	err = xfat_bpool_write_sector(to_obj(file->xfat), buf, 0);
 	if (err < 0) {
 		file->err = err;
 		return err;
@@ -2042,98 +2897,131 @@ static int is_fpos_cluster_end(xfile_t* file) {
 	return (cluster_offset == 0) && (file->pos == file->size);
 }
 
+/**
+ * 找到有cluster_count簇的簇链的最后一簇，簇链为空时为CLUSTER_INVALID
+ */
+static xfat_err_t file_last_cluster(xfile_t* file, u32_t cluster_count, u32_t* last_cluster) {
+	// 定位到簇边界的文件尾时当前簇无效，此时从起始簇开始查找链尾
+	u32_t curr_cluster = is_cluster_valid(file->curr_cluster) ? file->curr_cluster : file->start_cluster;
+	xfat_err_t err;
+
+	if (file->extents && cluster_count) {
+		err = file_cluster_at(file, cluster_count - 1, &curr_cluster, (u32_t*)0);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	*last_cluster = CLUSTER_INVALID;
+	while (is_cluster_valid(curr_cluster)) {
+		*last_cluster = curr_cluster;
+		err = get_next_cluster(file->xfat, curr_cluster, &curr_cluster);
+		if (err < 0) {
+			return err;
+		}
+	}
+	return FS_ERR_OK;
+}
+
 static xfat_err_t expand_file(xfile_t* file, xfile_size_t size) {
 	xfat_t* xfat = file->xfat;
 	u32_t curr_cluster_cnt = to_cluster_count(xfat, file->size);
 	u32_t expect_cluster_cnt = to_cluster_count(xfat, size);
+	u32_t reserved_cnt = 0;
 	xfat_err_t err;
 
+	// 先使用预分配在簇链尾部的簇，此时文件位置已随簇链移入预分配的簇，不必再调整当前簇
+	if ((curr_cluster_cnt < expect_cluster_cnt) && file->prealloc_clusters) {
+		reserved_cnt = expect_cluster_cnt - curr_cluster_cnt;
+		if (reserved_cnt > file->prealloc_clusters) {
+			reserved_cnt = file->prealloc_clusters;
+		}
+		file->prealloc_clusters -= reserved_cnt;
+		curr_cluster_cnt += reserved_cnt;
+	}
+
 	if (curr_cluster_cnt < expect_cluster_cnt) {
 		u32_t cluster_cnt = expect_cluster_cnt - curr_cluster_cnt;
 		u32_t start_free_cluster = 0;
-		u32_t curr_cluster = file->curr_cluster;
-
-		if (file->size > 0) {
-			u32_t next_cluster = curr_cluster;
-			do {
-				curr_cluster = next_cluster;
-				err = get_next_cluster(xfat, curr_cluster, &next_cluster);
-				if (err) {
-					file->err = err;
-					return err;
-				}
-			} while (is_cluster_valid(next_cluster));
+		u32_t allocated_cnt = 0;
+		u32_t curr_cluster;
+
+		err = file_last_cluster(file, curr_cluster_cnt, &curr_cluster);
+		if (err) {
+			file->err = err;
+			return err;
 		}
 
-		err = allocate_free_cluster(xfat, curr_cluster, cluster_cnt, &start_free_cluster, 0, 0, 0);
+		err = allocate_free_cluster(xfat, curr_cluster, cluster_cnt, &start_free_cluster, &allocated_cnt, 0, 0);
 		if (err) {
 			file->err = err;
 			return err;
 		}
 
-		// ļ,֮ǰûݴ
-		if (!is_cluster_valid(file->start_cluster)) {
-			file->start_cluster = start_free_cluster;
-			file->curr_cluster = start_free_cluster;
+		if (allocated_cnt) {
+			// 空文件,之前还没有内容簇
+			if (!is_cluster_valid(file->start_cluster)) {
+				file->start_cluster = start_free_cluster;
+				file->curr_cluster = start_free_cluster;
+			}
+			else if ((reserved_cnt == 0) && (!is_cluster_valid(file->curr_cluster) || is_fpos_cluster_end(file))) {
+				// 链接到已有的簇上
+				file->curr_cluster = start_free_cluster;
+			}
 		}
-		else if (!is_cluster_valid(file->curr_cluster) || is_fpos_cluster_end(file)) {
-			// ӵеĴ
-			file->curr_cluster = start_free_cluster;
+
+		// 空闲簇不足时只扩展到已有簇能容纳的大小，使文件大小与簇链一致，之后可继续扩展
+		if (allocated_cnt < cluster_cnt) {
+			xfile_size_t max_size = (xfile_size_t)(curr_cluster_cnt + allocated_cnt) * xfat->cluster_byte_size;
+			if (max_size > file->size) {
+				err = update_file_size(file, max_size);
+				if (err < 0) {
+					return err;
+				}
+			}
+			file->err = FS_ERR_DISK_FULL;
+			return FS_ERR_DISK_FULL;
 		}
 	}
 
 	return update_file_size(file, size);
 }
 
-xfile_size_t xfile_write(void* buffer, xfile_size_t elem_size, xfile_size_t count, xfile_t* file) {
-	xfile_size_t bytes_to_write = count * elem_size;
-	u8_t* write_buffer = (u8_t*)buffer;
-
-	if (file->type != FAT_FILE) {
-		file->err = FS_ERR_FSTYPE;
-		return 0;
-	}
-
-	if (file->attr & XFILE_ATTR_READONLY) {
-		file->err = FS_ERR_READONLY;
-		return 0;
-	}
-
-	if (bytes_to_write == 0) {
-		file->err = FS_ERR_OK;
-		return 0;
-	}
-
+// 从当前位置写入，返回实际写入的字节数
+static xfile_size_t write_file_bytes(xfile_t* file, u8_t* write_buffer, xfile_size_t bytes_to_write) {
 	xdisk_t* disk = file_get_disk(file);
 	xfile_size_t r_count_writed = 0;
+	xfat_err_t expand_err = FS_ERR_OK;
 
 	if (file->size < file->pos + bytes_to_write) {
-		xfat_err_t err = expand_file(file, file->pos + bytes_to_write);
-		if (err < 0) {
-			file->err = err;
+		// 空闲簇不足时仍写入已扩展的部分
+		expand_err = expand_file(file, file->pos + bytes_to_write);
+		if ((expand_err < 0) && (expand_err != FS_ERR_DISK_FULL)) {
+			file->err = expand_err;
 			return 0;
 		}
 	}
 
-	while ((bytes_to_write > 0) && is_cluster_valid(file->curr_cluster)) {
+	// 空闲簇不足时文件只扩展了一部分，写到文件末尾为止
+	while ((bytes_to_write > 0) && is_cluster_valid(file->curr_cluster) && (file->pos < file->size)) {
 		xfat_err_t err;
 		xfile_size_t curr_write_bytes = 0;
 		u32_t sector_count = 0;
-		// ǰcurr_clusterе
+		// 当前处于curr_cluster中的扇区编号
 		u32_t cluster_sector = to_sector(disk, to_cluster_offset(file->xfat, file->pos));
-		// ǰһеһbyte
+		// 点前处于一个扇区中的哪一个byte
 		u32_t sector_offset = to_sector_offset(disk, file->pos);
 
-		// ǰfatļϵͳеһ
+		// 当前处于fat文件系统中的哪一个扇区
 		u32_t start_sector = cluster_first_sector(file->xfat, file->curr_cluster) + cluster_sector;
-		// 1) ȡ߽粻ģȶȡһֱ֤߽
-		// 2) ߽ģǶȡݴССһҲ߼
+		// 1) 如果读取的左边界不是扇区对齐的，先读取玩第一部分保证其左边界扇区对齐
+		// 2) 如果左边界是扇区对齐的，但是读取的内容大小小于一个扇区则也可以走这个逻辑
 		if ((sector_offset != 0) || (!sector_offset && (bytes_to_write < disk->sector_size))) {
 			sector_count = 1;
 			curr_write_bytes = bytes_to_write;
 
 			if (sector_offset != 0) {
-				// ȶȡݵһֱ֤߽ܹ
+				// 先读取内容的一部分保证左边界能够扇区对齐
 				if (sector_offset + bytes_to_write > disk->sector_size) {
 					curr_write_bytes = disk->sector_size - sector_offset;
 				}
@@ -2158,18 +3046,21 @@ xfile_size_t xfile_write(void* buffer, xfile_size_t elem_size, xfile_size_t coun
 		}
 		else {
 			sector_count = to_sector(disk, bytes_to_write);
-			if ((cluster_sector + sector_count) > file->xfat->sec_per_cluster) {
-				sector_count = file->xfat->sec_per_cluster - cluster_sector;
+			err = file_contiguous_sectors(file, cluster_sector, &sector_count);
+			if (err < 0) {
+				file->err = err;
+				return r_count_writed;
 			}
 
 			err = xfat_bpool_invalid_sectors(to_obj(file), start_sector, sector_count);
 			if (err < 0) {
-				return err;
+				file->err = err;
+				return r_count_writed;
 			}
 			err = xdisk_write_sector(disk, write_buffer, start_sector, sector_count);
 			if (err != FS_ERR_OK) {
 				file->err = err;
-				return r_count_writed / elem_size;
+				return r_count_writed;
 			}
 
 			curr_write_bytes = sector_count * disk->sector_size;
@@ -2183,8 +3074,92 @@ xfile_size_t xfile_write(void* buffer, xfile_size_t elem_size, xfile_size_t coun
 		if (err) return 0;
 	}
 
-	file->err = file->pos == file->size;
-	return r_count_writed / elem_size;
+	file->err = (expand_err < 0) ? expand_err : (file->pos == file->size);
+	return r_count_writed;
+}
+
+/**
+ * 回写暂存的追加数据：一次为全部暂存数据扩展文件，分配的簇可以连续。
+ * 只写入部分时，未写入的数据移到缓冲区头部继续暂存，以便之后重试
+ */
+static xfat_err_t flush_delay_buf(xfile_t* file) {
+	u32_t len = file->delay_len;
+	u32_t writed;
+	if (len == 0) {
+		return FS_ERR_OK;
+	}
+
+	file->pos -= len;
+	writed = file->pos;
+
+	// 以读写位置的前进量为准，出错时write_file_bytes的返回值可能少于实际写入的量
+	write_file_bytes(file, file->delay_buf, len);
+	writed = file->pos - writed;
+	if (writed < len) {
+		memmove(file->delay_buf, file->delay_buf + writed, len - writed);
+		file->delay_len = len - writed;
+		file->pos += file->delay_len;
+		return (file->err < 0) ? file->err : FS_ERR_DISK_FULL;
+	}
+
+	file->delay_len = 0;
+	return FS_ERR_OK;
+}
+
+/**
+ * 设置延迟分配的暂存缓冲区。之后在文件末尾追加写入的数据先放入缓冲区，缓冲区满、读写位置改变、
+ * 改变大小或同步、关闭文件时才分配簇并写入。buf为空时回写暂存的数据并关闭延迟分配
+ */
+xfat_err_t xfile_set_delalloc(xfile_t* file, u8_t* buf, u32_t size) {
+	xfat_err_t err = flush_delay_buf(file);
+	if (err < 0) {
+		return err;
+	}
+
+	file->delay_buf = size ? buf : (u8_t*)0;
+	file->delay_size = buf ? size : 0;
+	return FS_ERR_OK;
+}
+
+xfile_size_t xfile_write(void* buffer, xfile_size_t elem_size, xfile_size_t count, xfile_t* file) {
+	xfile_size_t bytes_to_write = count * elem_size;
+
+	if (file->type != FAT_FILE) {
+		file->err = FS_ERR_FSTYPE;
+		return 0;
+	}
+
+	if (file->attr & XFILE_ATTR_READONLY) {
+		file->err = FS_ERR_READONLY;
+		return 0;
+	}
+
+	if (bytes_to_write == 0) {
+		file->err = FS_ERR_OK;
+		return 0;
+	}
+
+	if (file->delay_buf) {
+		// 紧接在暂存数据之后的追加写入继续暂存，放不下时先回写之前暂存的数据
+		u8_t is_append = file->pos == file->size + file->delay_len;
+		if (!is_append || (file->delay_len + bytes_to_write > file->delay_size)) {
+			xfat_err_t err = flush_delay_buf(file);
+			if (err < 0) {
+				file->err = err;
+				return 0;
+			}
+		}
+
+		if (is_append && (bytes_to_write <= file->delay_size)) {
+			memcpy(file->delay_buf + file->delay_len, buffer, bytes_to_write);
+			file->delay_len += bytes_to_write;
+			file->pos += bytes_to_write;
+			file->err = FS_ERR_OK;
+			return count;
+		}
+	}
+
+	return write_file_bytes(file, (u8_t*)buffer, bytes_to_write) / elem_size;
 }
 
 xfat_err_t xfile_eof(xfile_t* file) {
@@ -2198,6 +3173,11 @@ xfile_size_t xfile_tell(xfile_t* file) {
 xfat_err_t xfile_seek(xfile_t* file, xfile_ssize_t offset, xfile_origin_t origin) {
 	xfile_ssize_t final_pos;
 
+	xfat_err_t err = flush_delay_buf(file);
+	if (err < 0) {
+		return err;
+	}
+
 	switch (origin) {
 	case XFAT_SEEK_SET:
 		final_pos = offset;
@@ -2216,6 +3196,19 @@ xfat_err_t xfile_seek(xfile_t* file, xfile_ssize_t offset, xfile_origin_t origin
 		return FS_ERR_PARAM;
 	}
 
+	if (file->extents) {
+		u32_t curr_cluster;
+		err = file_cluster_at(file, to_cluster(file->xfat, final_pos), &curr_cluster, (u32_t*)0);
+		if (err < 0) {
+			file->err = err;
+			return err;
+		}
+
+		file->pos = (u32_t)final_pos;
+		file->curr_cluster = curr_cluster;
+		return FS_ERR_OK;
+	}
+
 	offset = final_pos - file->pos;
 	u32_t curr_cluster;
 	u32_t curr_pos;
@@ -2256,30 +3249,52 @@ xfat_err_t xfile_seek(xfile_t* file, xfile_ssize_t offset, xfile_origin_t origin
 }
 
 xfat_err_t xfile_size(xfile_t* file, xfile_size_t* size) {
-	*size = file->size;
+	*size = file->size + file->delay_len;
 
 	return FS_ERR_OK;
 }
 
-static xfat_err_t truncate_file(xfile_t* file, xfile_size_t size) {
-	xfat_err_t err;
+/**
+ * 保留簇链的前keep_count个簇，在此处结束簇链并释放其后的簇
+ */
+static xfat_err_t cut_cluster_chain(xfile_t* file, u32_t keep_count) {
+	u32_t last_cluster = CLUSTER_INVALID;
 	u32_t curr_cluster = file->start_cluster;
-	u32_t pos = 0;
+	xfat_err_t err;
 
-	while (pos < size) {
-		u32_t next_cluster;
-		err = get_next_cluster(file->xfat, curr_cluster, &next_cluster);
+	if (keep_count > 0) {
+		err = file_cluster_at(file, keep_count - 1, &last_cluster, (u32_t*)0);
+		if (err < 0) {
+			return err;
+		}
+		if (!is_cluster_valid(last_cluster)) {
+			return FS_ERR_OK;
+		}
+
+		err = get_next_cluster(file->xfat, last_cluster, &curr_cluster);
 		if (err < 0) {
 			return err;
 		}
-		pos += file->xfat->cluster_byte_size;
-		curr_cluster = next_cluster;
 	}
 
-	err = destory_cluster_chain(file->xfat, curr_cluster);
+	if (!is_cluster_valid(curr_cluster)) {
+		return FS_ERR_OK;
+	}
+
+	extent_map_cut(file, keep_count);
+	err = put_next_cluster(file->xfat, last_cluster, CLUSTER_INVALID);
 	if (err < 0) {
 		return err;
 	}
+	return destory_cluster_chain(file->xfat, curr_cluster);
+}
+
+static xfat_err_t truncate_file(xfile_t* file, xfile_size_t size) {
+	xfat_err_t err = cut_cluster_chain(file, to_cluster_count(file->xfat, size));
+	if (err < 0) {
+		return err;
+	}
+	file->prealloc_clusters = 0;
 	if (size == 0) {
 		file->start_cluster = 0;
 	}
@@ -2287,11 +3302,96 @@ static xfat_err_t truncate_file(xfile_t* file, xfile_size_t size) {
 	return update_file_size(file, size);
 }
 
+/**
+ * 在簇链尾部预先分配簇，使文件能容纳size字节。不改变文件大小，也不清除簇中原有的内容，
+ * 之后超出文件大小的写入直接使用这些簇，关闭文件时释放未用到的部分。
+ * flags为XFILE_FALLOC_RELEASE时，改为释放超出size的预分配簇
+ */
+xfat_err_t xfile_fallocate(xfile_t* file, xfile_size_t size, u32_t flags) {
+	xfat_t* xfat = file->xfat;
+	u32_t size_cluster_cnt, curr_cluster_cnt;
+	u32_t expect_cluster_cnt = to_cluster_count(xfat, size);
+	xfat_err_t err;
+
+	if (file->type != FAT_FILE) {
+		return FS_ERR_PARAM;
+	}
+
+	err = flush_delay_buf(file);
+	if (err < 0) {
+		return err;
+	}
+	size_cluster_cnt = to_cluster_count(xfat, file->size);
+	curr_cluster_cnt = size_cluster_cnt + file->prealloc_clusters;
+
+	if (flags & XFILE_FALLOC_RELEASE) {
+		if (expect_cluster_cnt < size_cluster_cnt) {
+			expect_cluster_cnt = size_cluster_cnt;
+		}
+		if (expect_cluster_cnt >= curr_cluster_cnt) {
+			return FS_ERR_OK;
+		}
+
+		err = cut_cluster_chain(file, expect_cluster_cnt);
+		if (err < 0) {
+			return err;
+		}
+		file->prealloc_clusters = expect_cluster_cnt - size_cluster_cnt;
+		if (expect_cluster_cnt == 0) {
+			file->start_cluster = file->curr_cluster = 0;
+			return update_file_size(file, file->size);
+		}
+		return FS_ERR_OK;
+	}
+
+	if (file->attr & XFILE_ATTR_READONLY) {
+		return FS_ERR_READONLY;
+	}
+	if (expect_cluster_cnt <= curr_cluster_cnt) {
+		return FS_ERR_OK;
+	}
+
+	u32_t last_cluster;
+	err = file_last_cluster(file, curr_cluster_cnt, &last_cluster);
+	if (err < 0) {
+		return err;
+	}
+
+	u32_t start_free_cluster, allocated_cnt;
+	err = allocate_free_cluster(xfat, last_cluster, expect_cluster_cnt - curr_cluster_cnt, &start_free_cluster, &allocated_cnt, 0, 0);
+	if (err < 0) {
+		return err;
+	}
+
+	if (allocated_cnt) {
+		if (!is_cluster_valid(file->start_cluster)) {
+			// 空文件，在目录项中记下起始簇
+			file->start_cluster = file->curr_cluster = start_free_cluster;
+			err = update_file_size(file, file->size);
+			if (err < 0) {
+				return err;
+			}
+		}
+		else if ((file->prealloc_clusters == 0) && (file->pos > 0) && is_fpos_cluster_end(file)) {
+			// 位于文件末尾且恰好在簇边界时，当前簇还停留在上一簇或已无效，移到新分配的簇
+			file->curr_cluster = start_free_cluster;
+		}
+		file->prealloc_clusters += allocated_cnt;
+	}
+
+	return (allocated_cnt < expect_cluster_cnt - curr_cluster_cnt) ? FS_ERR_DISK_FULL : FS_ERR_OK;
+}
+
 xfat_err_t xfile_resize(xfile_t* file, xfile_size_t size) {
 	if (file->type != FAT_FILE) {
 		return FS_ERR_PARAM;
 	}
 
+	xfat_err_t err = flush_delay_buf(file);
+	if (err < 0) {
+		return err;
+	}
+
 	if (size == file->size) {
 		return FS_ERR_OK;
 	}
@@ -2374,11 +3474,11 @@ xfat_err_t xfile_rename(const char* path, const char* new_name) {
 }
 
 /**
- * diritemӦʱ䣬ļʱ޸ĵĻص
- * @param xfat xfatṹ
- * @param dir_item Ŀ¼ṹ
- * @param arg1 ޸ĵʱ
- * @param arg2 µʱ
+ * 设置diritem中相应的时间，用作文件时间修改的回调函数
+ * @param xfat xfat结构
+ * @param dir_item 目录结构项
+ * @param arg1 修改的时间类型
+ * @param arg2 新的时间
  * @return
  */
 static xfat_err_t set_file_time(const char* path, stime_type_t time_type, xfile_time_t* time) {
@@ -2406,12 +3506,12 @@ static xfat_err_t set_file_time(const char* path, stime_type_t time_type, xfile_
 				return err;
 			}
 
-			if (diritem == (diritem_t*)0) {    // ѾĿ¼
+			if (diritem == (diritem_t*)0) {    // 已经搜索到目录结束
 				return FS_ERR_NONE;
 			}
 
 			if (is_filename_match((const char*)diritem->DIR_Name, curr_path)) {
-				// ҵȽһĿ¼
+				// 找到，比较下一级子目录
 				if (get_child_path(curr_path)) {
 					curr_cluster = get_diritem_cluster(diritem);
 					curr_offset = 0;
@@ -2425,10 +3525,10 @@ static xfat_err_t set_file_time(const char* path, stime_type_t time_type, xfile_
 	}
 
 	if (diritem && !curr_path) {
-		// ַʽֻSFNļ
+		// 这种方式只能用于SFN文件项重命名
 		u32_t dir_sector = to_phy_sector(xfat, curr_cluster, curr_offset);
 
-		// ļʵôСд
+		// 根据文件名的实际情况，重新配置大小写
 		switch (time_type) {
 		case XFAT_TIME_CTIME:
 			diritem->DIR_CrtDate.year_from_1980 = (u16_t)(time->year - 1980);
@@ -7,42 +7,42 @@
 #pragma pack(1)
 
 /**
- * FATļϵͳBPBṹ
+ * FAT文件系统的BPB结构
  */
 typedef struct _bpb_t {
-	u8_t BS_jmpBoot[3];                 // ת
-	u8_t BS_OEMName[8];                 // OEM
-	u16_t BPB_BytsPerSec;               // ÿֽ
-	u8_t BPB_SecPerClus;                // ÿ
-	u16_t BPB_RsvdSecCnt;               // 
-	u8_t BPB_NumFATs;                   // FAT
-	u16_t BPB_RootEntCnt;               // Ŀ¼Ŀ
-	u16_t BPB_TotSec16;                 // ܵ
-	u8_t BPB_Media;                     // ý
-	u16_t BPB_FATSz16;                  // FATС
-	u16_t BPB_SecPerTrk;                // ÿŵ
-	u16_t BPB_NumHeads;                 // ͷ
-	u32_t BPB_HiddSec;                  // 
-	u32_t BPB_TotSec32;                 // ܵ
+	u8_t BS_jmpBoot[3];                 // 跳转代码
+	u8_t BS_OEMName[8];                 // OEM名称
+	u16_t BPB_BytsPerSec;               // 每扇区字节数
+	u8_t BPB_SecPerClus;                // 每簇扇区数
+	u16_t BPB_RsvdSecCnt;               // 保留区扇区数
+	u8_t BPB_NumFATs;                   // FAT表项数
+	u16_t BPB_RootEntCnt;               // 根目录项目数
+	u16_t BPB_TotSec16;                 // 总的扇区数
+	u8_t BPB_Media;                     // 媒体类型
+	u16_t BPB_FATSz16;                  // FAT表项大小
+	u16_t BPB_SecPerTrk;                // 每磁道扇区数
+	u16_t BPB_NumHeads;                 // 磁头数
+	u32_t BPB_HiddSec;                  // 隐藏扇区数
+	u32_t BPB_TotSec32;                 // 总的扇区数
 } bpb_t;
 
 /**
- * BPBеFAT32ṹ
+ * BPB中的FAT32结构
  */
 typedef struct _fat32_hdr_t {
-	u32_t BPB_FATSz32;                  // FATֽڴС
-	u16_t BPB_ExtFlags;                 // չ
-	u16_t BPB_FSVer;                    // 汾
-	u32_t BPB_RootClus;                 // Ŀ¼Ĵغ
-	u16_t BPB_FsInfo;                   // fsInfo
-	u16_t BPB_BkBootSec;                // 
+	u32_t BPB_FATSz32;                  // FAT表的字节大小
+	u16_t BPB_ExtFlags;                 // 扩展标记
+	u16_t BPB_FSVer;                    // 版本号
+	u32_t BPB_RootClus;                 // 根目录的簇号
+	u16_t BPB_FsInfo;                   // fsInfo的扇区号
+	u16_t BPB_BkBootSec;                // 备份扇区
 	u8_t BPB_Reserved[12];
-	u8_t BS_DrvNum;                     // 豸
+	u8_t BS_DrvNum;                     // 设备号
 	u8_t BS_Reserved1;
-	u8_t BS_BootSig;                    // չ
-	u32_t BS_VolID;                     // к
-	u8_t BS_VolLab[11];                 // 
-	u8_t BS_FileSysType[8];             // ļ
+	u8_t BS_BootSig;                    // 扩展标记
+	u32_t BS_VolID;                     // 卷序列号
+	u8_t BS_VolLab[11];                 // 卷标名称
+	u8_t BS_FileSysType[8];             // 文件类型名称
 } fat32_hdr_t;
 
 typedef struct _dbr_t {
@@ -50,23 +50,23 @@ typedef struct _dbr_t {
 	fat32_hdr_t fat32;
 } dbr_t;
 
-#define CLUSTER_INVALID                 0x0FFFFFFF          // ЧĴغ
+#define CLUSTER_INVALID                 0x0FFFFFFF          // 无效的簇号
 #define CLUSTER_FREE 0
 #define FILE_DEFAULT_CLUSTER 0
-#define DIRITEM_NAME_FREE               0xE5                // Ŀ¼
-#define DIRITEM_NAME_END                0x00                // Ŀ¼
+#define DIRITEM_NAME_FREE               0xE5                // 目录项空闲名标记
+#define DIRITEM_NAME_END                0x00                // 目录项结束名标记
 
 #define DIRITEM_NTRES_BODY_LOWER 0x08 // (1 << 3)
 #define DIRITEM_NTRES_EXT_LOWER 0x10 // (1 << 4)
 #define DIRITEM_NTRES_CASE_MASK 0x18
 
-#define DIRITEM_ATTR_READ_ONLY          0x01                // Ŀ¼ԣֻ
-#define DIRITEM_ATTR_HIDDEN             0x02                // Ŀ¼ԣ
-#define DIRITEM_ATTR_SYSTEM             0x04                // Ŀ¼ԣϵͳ
-#define DIRITEM_ATTR_VOLUME_ID          0x08                // Ŀ¼ԣid
-#define DIRITEM_ATTR_DIRECTORY          0x10                // Ŀ¼ԣĿ¼
-#define DIRITEM_ATTR_ARCHIVE            0x20                // Ŀ¼ԣ鵵
-#define DIRITEM_ATTR_LONG_NAME          0x0F                // Ŀ¼ԣļ
+#define DIRITEM_ATTR_READ_ONLY          0x01                // 目录项属性：只读
+#define DIRITEM_ATTR_HIDDEN             0x02                // 目录项属性：隐藏
+#define DIRITEM_ATTR_SYSTEM             0x04                // 目录项属性：系统类型
+#define DIRITEM_ATTR_VOLUME_ID          0x08                // 目录项属性：卷id
+#define DIRITEM_ATTR_DIRECTORY          0x10                // 目录项属性：目录
+#define DIRITEM_ATTR_ARCHIVE            0x20                // 目录项属性：归档
+#define DIRITEM_ATTR_LONG_NAME          0x0F                // 目录项属性：长文件名
 
 #define DIRITEM_GET_FREE (1 << 0)
 #define DIRITEM_GET_USED (1 << 1)
@@ -74,37 +74,37 @@ typedef struct _dbr_t {
 #define DIRITEM_GET_ALL (0XFF)
 
 /**
- * FATĿ¼
+ * FAT目录项的日期类型
  */
 typedef struct _diritem_date_t {
-	u16_t day : 5;                  // 
-	u16_t month : 4;                // 
-	u16_t year_from_1980 : 7;       // 
+	u16_t day : 5;                  // 日
+	u16_t month : 4;                // 月
+	u16_t year_from_1980 : 7;       // 年
 } diritem_date_t;
 
 /**
- * FATĿ¼ʱ
+ * FAT目录项的时间类型
  */
 typedef struct _diritem_time_t {
-	u16_t second_2 : 5;             // ྫȷ2룬ȡֵΪ0-29
-	u16_t minute : 6;               // 
-	u16_t hour : 5;                 // ʱ
+	u16_t second_2 : 5;             // 最多精确到2秒，取值为0-29
+	u16_t minute : 6;               // 分
+	u16_t hour : 5;                 // 时
 } diritem_time_t;
 
 typedef struct _diritem_t {
-	u8_t DIR_Name[8];                   // ļ
-	u8_t DIR_ExtName[3];                // չ
-	u8_t DIR_Attr;                      // 
+	u8_t DIR_Name[8];                   // 文件名
+	u8_t DIR_ExtName[3];                // 扩展名
+	u8_t DIR_Attr;                      // 属性
 	u8_t DIR_NTRes;
-	u8_t DIR_CrtTimeTeenth;             // ʱĺ
-	diritem_time_t DIR_CrtTime;         // ʱ
-	diritem_date_t DIR_CrtDate;         // 
-	diritem_date_t DIR_LastAccDate;     // 
-	u16_t DIR_FstClusHI;                // غŸ16λ
-	diritem_time_t DIR_WrtTime;         // ޸ʱ
-	diritem_date_t DIR_WrtDate;         // ޸ʱ
-	u16_t DIR_FstClusL0;                // غŵ16λ
-	u32_t DIR_FileSize;                 // ļֽڴС
+	u8_t DIR_CrtTimeTeenth;             // 创建时间的毫秒
+	diritem_time_t DIR_CrtTime;         // 创建时间
+	diritem_date_t DIR_CrtDate;         // 创建日期
+	diritem_date_t DIR_LastAccDate;     // 最后访问日期
+	u16_t DIR_FstClusHI;                // 簇号高16位
+	diritem_time_t DIR_WrtTime;         // 修改时间
+	diritem_date_t DIR_WrtDate;         // 修改时期
+	u16_t DIR_FstClusL0;                // 簇号低16位
+	u32_t DIR_FileSize;                 // 文件字节大小
 } diritem_t;
 
 typedef union _cluster32_t {
@@ -116,41 +116,64 @@ typedef union _cluster32_t {
 } cluster32_t;
 
 /**
- * FSInfoṹ
+ * FSInfo结构
  */
 typedef struct _fsinfo_t {
-	u32_t FSI_LoadSig;                  // ̶ǣ0x41615252
+	u32_t FSI_LoadSig;                  // 固定标记：0x41615252
 	u8_t FSI_Reserved1[480];
-	u32_t FSI_StrucSig;                 // ̶ǣ 0x61417272
-	u32_t FSI_Free_Count;               // ʣ
-	u32_t FSI_Next_Free;                // Ӻδʼʣ
+	u32_t FSI_StrucSig;                 // 固定标记： 0x61417272
+	u32_t FSI_Free_Count;               // 最新剩余簇数
+	u32_t FSI_Next_Free;                // 从何处开始找剩余簇
 	u8_t FSI_Reserved2[12];
-	u32_t FSI_TrailSig;                 // ̶ǣ 0xAA550000
+	u32_t FSI_TrailSig;                 // 固定标记： 0xAA550000
 } fsinfo_t;
 
 #pragma pack()
 
 #define XFAT_NAME_LEN 16
+#define XFAT_MIRROR_SYNC_SIZE (16 * 1024)   // 同步FAT镜像表时一次复制的最大字节数
+#define XFAT_ALLOC_SCAN_MAX (64 * 1024)    // 无空闲簇位图时，查找连续空闲簇最多检查的簇数
+#define XFAT_DISCARD_RUN_NR 16              // 等待回收存储空间的簇段最大数量，超出后新释放的簇段不再回收
+
+/**
+ * 一段连续的簇
+ */
+typedef struct _xfat_cluster_run_t {
+	u32_t start;
+	u32_t count;
+} xfat_cluster_run_t;
 
 typedef struct _xfat_t {
 	xfat_obj_t obj;
 	char name[XFAT_NAME_LEN];
-	u32_t fat_start_sector; // Fatʼ
-	u32_t fat_tbl_nr; // Fat
-	u32_t fat_tbl_sectors; // ÿļFATռõ
-	u32_t sec_per_cluster; // ÿм
-	u32_t root_cluster; // Ŀ¼
-	u32_t cluster_byte_size; // һռֽ
-	u32_t total_sectors; // 
+	u32_t fat_start_sector; // Fat分配表的起始扇区
+	u32_t fat_tbl_nr; // Fat分配表的数量
+	u32_t fat_tbl_sectors; // 每个文件分配表（FAT）占用的扇区数。
+	u32_t sec_per_cluster; // 每个簇有几个扇区
+	u32_t root_cluster; // 根目录簇
+	u32_t cluster_byte_size; // 一个簇占几个字节
+	u32_t total_sectors; // 总扇区数
 
 	u32_t fsi_sector;
 	u32_t backup_sector;
 	u32_t cluster_next_free;
 	u32_t cluster_total_free;
 
+	u8_t fat_mirror_defer; // 镜像表延迟同步，修改FAT表时只更新缓存中的主表
+	u32_t mirror_dirty_start; // 镜像表待同步的扇区范围，相对于FAT表起始
+	u32_t mirror_dirty_end;
+
+	u32_t* free_map; // 空闲簇位图，置1表示该簇空闲，为0时分配簇需逐个查FAT表
+	u32_t free_map_words;
+
+	xfat_cluster_run_t discard_runs[XFAT_DISCARD_RUN_NR]; // 已释放的簇段，FAT表及目录落盘后再通知磁盘回收
+	u32_t discard_run_count;
+
 	xdisk_part_t* disk_part;
 
-	xfat_bpool_t bpool;
+	xfat_bpool_t bpool; // 文件数据缓存，FAT表或目录分区为空时也用于缓存这两类扇区
+	xfat_bpool_t fat_bpool; // FAT表扇区缓存
+	xfat_bpool_t dir_bpool; // 目录等其它元数据扇区缓存
 
 	struct _xfat_t* next;
 } xfat_t;
@@ -162,6 +185,8 @@ typedef enum _xfile_type_t {
 } xfile_type_t;
 
 #define XFILE_ATTR_READONLY (1 << 0)
+
+#define XFILE_FALLOC_RELEASE (1 << 0) // 释放超出指定大小的预分配簇
 #define SFN_LEN 11
 
 #define XFILE_LOCATE_NORMAL (1 << 0)
@@ -171,6 +196,18 @@ typedef enum _xfile_type_t {
 #define XFILE_LOCATE_HIDDEN (1 << 4)
 #define XFILE_LOCATE_ALL 0xFF
 
+#define XFILE_RA_MIN_SECTORS 4 // 顺序读时的最小预读窗口（扇区数）
+#define XFILE_RA_MAX_SECTORS 32 // 最大预读窗口（扇区数）
+
+/**
+ * 文件簇链中的一段物理连续的簇
+ */
+typedef struct _xfile_extent_t {
+	u32_t index; // 段首簇在文件中的簇序号
+	u32_t cluster; // 段首簇号
+	u32_t count; // 连续的簇数
+} xfile_extent_t;
+
 typedef struct _xfile_t {
 	xfat_obj_t obj;
 	xfat_t* xfat;
@@ -185,6 +222,20 @@ typedef struct _xfile_t {
 	u32_t dir_cluster;
 	u32_t dir_cluster_offset;
 
+	u32_t ra_last_pos; // 上次读取结束的位置，用于判断是否顺序读
+	u32_t ra_end; // 已预读数据的结束位置
+	u32_t ra_window; // 当前预读窗口（扇区数）
+
+	u32_t prealloc_clusters; // 文件大小之外，预先链接在簇链尾部的簇数
+
+	u8_t* delay_buf; // 延迟分配时暂存追加写入的数据，为0时不启用
+	u32_t delay_size;
+	u32_t delay_len; // 已暂存的字节数，数据位于文件末尾之后
+
+	xfile_extent_t* extents; // 簇链的区段映射，为0时不启用
+	u32_t extent_max;
+	u32_t extent_cnt; // 已映射的区段数，映射的总是簇链的前面部分
+
 	xfat_bpool_t bpool;
 } xfile_t;
 
@@ -253,7 +304,12 @@ xfat_err_t get_next_cluster(xfat_t* xfat, u32_t curr_cluster, u32_t* next_cluste
 xfat_err_t xfat_init(void);
 xfat_err_t xfat_mount(xfat_t* xfat, xdisk_part_t* part, const char* mount_name);
 void xfat_unmount(xfat_t* xfat);
-xfat_err_t xfat_set_buf(xfat_t* xfat, u8_t* buf, u32_t size);
+xfat_err_t xfat_sync(xfat_t* xfat);
+xfat_err_t xfat_set_buf(xfat_t* xfat, u8_t* buf, u32_t fat_size, u32_t dir_size, u32_t data_size);
+xfat_err_t xfat_set_fat_mirror_defer(xfat_t* xfat, u8_t defer);
+xfat_err_t xfat_sync_fat_mirror(xfat_t* xfat);
+u32_t xfat_free_map_size(xfat_t* xfat);
+xfat_err_t xfat_set_free_map(xfat_t* xfat, u32_t* map, u32_t size);
 
 xfat_err_t xfat_fmt_ctrl_init(xfat_fmt_ctrl_t* ctrl);
 xfat_err_t xfat_format(xdisk_part_t* disk_part, xfat_fmt_ctrl_t* ctrl);
@@ -263,7 +319,10 @@ xfat_err_t read_cluster(xfat_t* xfat, u8_t* buffer, u32_t cluster, u32_t count);
 xfat_err_t xfile_open(xfile_t* file, const char* path);
 xfat_err_t xfile_open_sub(xfile_t* dir, const char* sub_path, xfile_t* sub_file);
 xfat_err_t xfile_close(xfile_t* file);
+xfat_err_t xfile_sync(xfile_t* file);
 xfat_err_t xfile_set_buf(xfile_t* file, u8_t* buf, u32_t size);
+xfat_err_t xfile_set_delalloc(xfile_t* file, u8_t* buf, u32_t size);
+xfat_err_t xfile_set_extent_map(xfile_t* file, xfile_extent_t* extents, u32_t size);
 
 xfat_err_t xdir_first_file(xfile_t* file, xfileinfo_t* info);
 xfat_err_t xdir_next_file(xfile_t* file, xfileinfo_t* info);
@@ -285,6 +344,7 @@ xfat_err_t xfile_seek(xfile_t* file, xfile_ssize_t ssize, xfile_origin_t origin)
 
 xfat_err_t xfile_size(xfile_t* file, xfile_size_t* size);
 xfat_err_t xfile_resize(xfile_t* file, xfile_size_t size);
+xfat_err_t xfile_fallocate(xfile_t* file, xfile_size_t size, u32_t flags);
 xfat_err_t xfile_rename(const char* path, const char* new_name);
 
 xfat_err_t xfile_set_atime(const char* path, xfile_time_t* time);
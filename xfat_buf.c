@@ -1,7 +1,32 @@
+#include <string.h>
 #include "xfat_buf.h"
 #include "xdisk.h"
 #include "xfat.h"
 
+static u8_t bounce_buf[XFAT_BUF_BOUNCE_SIZE];
+
+// 批量提交的磁盘请求，同一时刻只对一个磁盘
+typedef struct _bpool_io_t {
+	xdisk_io_t io;
+	xfat_bpool_t* pool;
+} bpool_io_t;
+
+typedef struct _bpool_io_batch_t {
+	xdisk_t* disk;
+	u32_t count;
+	u32_t bounce_used;
+	u32_t iov_used;
+	bpool_io_t io[XFAT_BUF_IO_MAX];
+} bpool_io_batch_t;
+
+static bpool_io_batch_t io_batch;
+static u8_t io_bounce_buf[XFAT_BUF_IO_BOUNCE_SIZE];
+static xdisk_iovec_t io_iov[XFAT_BUF_IO_IOV_MAX * 4];
+
+static xfat_err_t bpool_writeback(xfat_obj_t* obj, xfat_bpool_t* pool);
+static xfat_err_t bpool_io_wait(void);
+static xfat_err_t bpool_io_wait_pool(xfat_bpool_t* pool);
+
 static xfat_bpool_t* get_obj_bpool(xfat_obj_t* obj, u8_t use_low) {
 	xfat_bpool_t* pool;
 
@@ -31,6 +56,34 @@ static xfat_bpool_t* get_obj_bpool(xfat_obj_t* obj, u8_t use_low) {
 	return (xfat_bpool_t*)0;
 }
 
+// 卷对象按扇区所在区域分区：FAT表扇区、目录等其它元数据扇区各有缓存池，分区为空时使用卷的数据缓存池
+static xfat_bpool_t* get_sector_bpool(xfat_obj_t* obj, u32_t sector_no) {
+	if (obj->type == XFAT_OBJ_FAT) {
+		xfat_t* xfat = to_type(obj, xfat_t);
+		u32_t fat_end_sector = xfat->fat_start_sector + xfat->fat_tbl_sectors * xfat->fat_tbl_nr;
+		xfat_bpool_t* pool = ((sector_no >= xfat->fat_start_sector) && (sector_no < fat_end_sector)) ?
+			&xfat->fat_bpool : &xfat->dir_bpool;
+		if (pool->size > 0) {
+			return pool;
+		}
+	}
+
+	return get_obj_bpool(obj, 1);
+}
+
+static xfat_bpool_t* get_obj_part_bpool(xfat_obj_t* obj, xfat_bpool_part_t part) {
+	if (part == XFAT_BPOOL_PART_DATA) {
+		return get_obj_bpool(obj, 0);
+	}
+
+	if (obj->type != XFAT_OBJ_FAT) {
+		return (xfat_bpool_t*)0;
+	}
+
+	xfat_t* xfat = to_type(obj, xfat_t);
+	return (part == XFAT_BPOOL_PART_FAT) ? &xfat->fat_bpool : &xfat->dir_bpool;
+}
+
 void xfat_buf_set_state(xfat_buf_t* buf, u32_t state) {
 	buf->flags &= ~XFAT_BUF_STATE_MSK;
 	buf->flags |= state;
@@ -48,294 +101,1326 @@ static xdisk_t* get_obj_disk(xfat_obj_t* obj) {
 	return (xdisk_t*)0;
 }
 
-static xfat_err_t bpool_moveto_first(xfat_bpool_t* pool, xfat_buf_t* buf) {
-	if (pool->first == buf) {
-		return FS_ERR_OK;
+// 更新缓存状态，同时维护缓存池的脏缓存计数及变脏时刻
+static void bpool_set_state(xfat_bpool_t* pool, xfat_buf_t* buf, u32_t state) {
+	u32_t old_state = xfat_buf_state(buf);
+	if ((old_state != XFAT_BUF_STATE_DIRTY) && (state == XFAT_BUF_STATE_DIRTY)) {
+		buf->dirty_stamp = pool->miss_count;
+		pool->dirty_count++;
+	}
+	else if ((old_state == XFAT_BUF_STATE_DIRTY) && (state != XFAT_BUF_STATE_DIRTY)) {
+		pool->dirty_count--;
+	}
+
+	xfat_buf_set_state(buf, state);
+}
+
+static void bpool_unlink(xfat_bpool_t* pool, xfat_buf_t* buf) {
+	if (pool->first == pool->last) {
+		pool->first = pool->last = (xfat_buf_t*)0;
+		return;
 	}
 
 	buf->pre->next = buf->next;
 	buf->next->pre = buf->pre;
+	if (pool->first == buf) {
+		pool->first = buf->next;
+	}
 	if (pool->last == buf) {
 		pool->last = buf->pre;
 	}
+}
 
-	pool->last->next = buf;
-	pool->first->pre = buf;
+static void bpool_link_first(xfat_bpool_t* pool, xfat_buf_t* buf) {
+	if (pool->first == (xfat_buf_t*)0) {
+		buf->pre = buf->next = buf;
+		pool->first = pool->last = buf;
+		return;
+	}
 
 	buf->next = pool->first;
-	buf->pre = pool->first->pre;
+	buf->pre = pool->last;
+	pool->first->pre = buf;
+	pool->last->next = buf;
 	pool->first = buf;
+}
+
+static xfat_err_t bpool_moveto_first(xfat_bpool_t* pool, xfat_buf_t* buf) {
+	if (pool->first == buf) {
+		return FS_ERR_OK;
+	}
+
+	bpool_unlink(pool, buf);
+	bpool_link_first(pool, buf);
 	return FS_ERR_OK;
 }
 
-static xfat_err_t bpool_find_buf(xfat_bpool_t* pool, u32_t sector_no, xfat_buf_t** buf) {
-	if (pool->first == (xfat_buf_t*)0) {
-		return FS_ERR_NO_BUFFER;
+static xfat_err_t bpool_moveto_last(xfat_bpool_t* pool, xfat_buf_t* buf) {
+	if (pool->last == buf) {
+		return FS_ERR_OK;
 	}
 
-	xfat_buf_t* r_buf = pool->first;
-	u32_t size = pool->size;
-	xfat_buf_t* free_buf = (xfat_buf_t*)0;
-	while (size--) {
-		switch (xfat_buf_state(r_buf)) {
-			free_buf = r_buf;
-			break;
-		case XFAT_BUF_STATE_CLEAN:
-		case XFAT_BUF_STATE_DIRTY:
-			if (r_buf->sector_no == sector_no) {
-				*buf = r_buf;
-				return bpool_moveto_first(pool, r_buf);
-			}
+	bpool_moveto_first(pool, buf);
+	pool->first = buf->next;
+	pool->last = buf;
+	return FS_ERR_OK;
+}
+
+static void bpool_link_after(xfat_bpool_t* pool, xfat_buf_t* pos, xfat_buf_t* buf) {
+	buf->pre = pos;
+	buf->next = pos->next;
+	pos->next->pre = buf;
+	pos->next = buf;
+	if (pool->last == pos) {
+		pool->last = buf;
+	}
+}
+
+// 2Q策略下热区最多占缓存池的3/4，读入后经过1/4缓存池大小次未命中后再次访问才算热点
+#define bpool_hot_max(pool)         ((pool)->size * 3 / 4)
+#define bpool_cold_period(pool)     ((pool)->size / 4)
+
+// 一次读入的扇区数不能超过冷区的一半，否则读入的扇区会相互挤出
+#define bpool_fill_max(pool)        (((pool)->size - (pool)->hot_count) / 2)
+
+// 允许的最大脏缓存数，超过后回写到该值的一半
+#define bpool_dirty_max(pool)       ((pool)->size * (pool)->dirty_ratio / 100)
+
+static void bpool_cool_buf(xfat_bpool_t* pool, xfat_buf_t* buf) {
+	if (!(buf->flags & XFAT_BUF_HOT)) {
+		return;
+	}
+
+	if (pool->hot_last == buf) {
+		pool->hot_last = (pool->hot_count > 1) ? buf->pre : (xfat_buf_t*)0;
+	}
+	buf->flags &= ~XFAT_BUF_HOT;
+	pool->hot_count--;
+}
+
+// 缓存命中：LRU移到头部；2Q中热区缓存移到头部，冷区缓存满足条件时提升到热区
+static void bpool_touch_buf(xfat_bpool_t* pool, xfat_buf_t* buf) {
+	if (pool->policy == XFAT_BPOOL_LRU) {
+		bpool_moveto_first(pool, buf);
+		return;
+	}
+
+	if (buf->flags & XFAT_BUF_HOT) {
+		if ((pool->hot_last == buf) && (pool->hot_count > 1)) {
+			pool->hot_last = buf->pre;
+		}
+		bpool_moveto_first(pool, buf);
+		return;
+	}
+
+	// 预读的扇区从第一次被访问开始计算
+	if (buf->flags & XFAT_BUF_PREFETCHED) {
+		buf->flags &= ~XFAT_BUF_PREFETCHED;
+		buf->stamp = pool->miss_count;
+		return;
+	}
+
+	// 读入后很快又被访问的（如小块顺序读同一扇区）不算热点，留在冷区
+	if (pool->miss_count - buf->stamp < bpool_cold_period(pool)) {
+		return;
+	}
+
+	bpool_moveto_first(pool, buf);
+	buf->flags |= XFAT_BUF_HOT;
+	if (pool->hot_last == (xfat_buf_t*)0) {
+		pool->hot_last = buf;
+	}
+	pool->hot_count++;
+
+	// 热区已满，将热区最后一个降级到冷区头部
+	if (pool->hot_count > bpool_hot_max(pool)) {
+		xfat_buf_t* cold_buf = pool->hot_last;
+		bpool_cool_buf(pool, cold_buf);
+		cold_buf->stamp = pool->miss_count;
+	}
+}
+
+// 未命中时读入新扇区的缓存：LRU放到头部，2Q放到冷区头部
+static void bpool_insert_buf(xfat_bpool_t* pool, xfat_buf_t* buf) {
+	pool->miss_count++;
+	buf->stamp = pool->miss_count;
+	buf->flags &= ~XFAT_BUF_PREFETCHED;
+
+	bpool_cool_buf(pool, buf);
+	if ((pool->policy == XFAT_BPOOL_LRU) || (pool->hot_last == (xfat_buf_t*)0)) {
+		bpool_moveto_first(pool, buf);
+		return;
+	}
+
+	if (pool->hot_last->next != buf) {
+		bpool_unlink(pool, buf);
+		bpool_link_after(pool, pool->hot_last, buf);
+	}
+}
+
+static u32_t bpool_hash(xfat_bpool_t* pool, u32_t sector_no) {
+	return sector_no % pool->hash_size;
+}
+
+static xfat_buf_t* bpool_hash_find(xfat_bpool_t* pool, u32_t sector_no) {
+	xfat_buf_t* buf = pool->hash_tbl[bpool_hash(pool, sector_no)];
+	while (buf != (xfat_buf_t*)0) {
+		if (buf->hash_sector == sector_no) {
+			return buf;
+		}
+		buf = buf->hash_next;
+	}
+	return (xfat_buf_t*)0;
+}
+
+static void bpool_hash_remove(xfat_bpool_t* pool, xfat_buf_t* buf) {
+	if (!(buf->flags & XFAT_BUF_HASHED)) {
+		return;
+	}
+
+	xfat_buf_t** pp = &pool->hash_tbl[bpool_hash(pool, buf->hash_sector)];
+	while (*pp != (xfat_buf_t*)0) {
+		if (*pp == buf) {
+			*pp = buf->hash_next;
 			break;
 		}
+		pp = &(*pp)->hash_next;
+	}
+
+	buf->hash_next = (xfat_buf_t*)0;
+	buf->flags &= ~XFAT_BUF_HASHED;
+}
+
+static void bpool_hash_add(xfat_bpool_t* pool, xfat_buf_t* buf) {
+	u32_t idx = bpool_hash(pool, buf->sector_no);
+	buf->hash_sector = buf->sector_no;
+	buf->hash_next = pool->hash_tbl[idx];
+	pool->hash_tbl[idx] = buf;
+	buf->flags |= XFAT_BUF_HASHED;
+}
+
+// 将缓存从索引及LRU中摘除，放到链表尾部优先被复用
+static void bpool_discard_buf(xfat_bpool_t* pool, xfat_buf_t* buf) {
+	bpool_hash_remove(pool, buf);
+	bpool_set_state(pool, buf, XFAT_BUF_STATE_FREE);
+	bpool_cool_buf(pool, buf);
+	bpool_moveto_last(pool, buf);
+}
+
+// 调用者可能直接修改了sector_no后再回写（如FAT镜像表），需按新扇区号重建索引
+static void bpool_rehash_buf(xfat_bpool_t* pool, xfat_buf_t* buf) {
+	if ((buf->flags & XFAT_BUF_HASHED) && (buf->hash_sector == buf->sector_no)) {
+		return;
+	}
+
+	bpool_hash_remove(pool, buf);
+
+	xfat_buf_t* old_buf = bpool_hash_find(pool, buf->sector_no);
+	if (old_buf != (xfat_buf_t*)0) {
+		bpool_discard_buf(pool, old_buf);
+	}
+
+	bpool_hash_add(pool, buf);
+}
+
+// 从链表尾部向前找第一个未被固定的缓存作为替换对象，全部被固定时返回0
+static xfat_buf_t* bpool_get_victim(xfat_bpool_t* pool) {
+	xfat_buf_t* buf = pool->last;
+	for (u32_t i = 0; i < pool->size; i++, buf = buf->pre) {
+		if (buf->ref == 0) {
+			return buf;
+		}
+	}
+	return (xfat_buf_t*)0;
+}
 
-		r_buf = r_buf->next;
+static xfat_err_t bpool_find_buf(xfat_bpool_t* pool, u32_t sector_no, xfat_buf_t** buf) {
+	if (pool->first == (xfat_buf_t*)0) {
+		return FS_ERR_NO_BUFFER;
 	}
 
-	if (free_buf != (xfat_buf_t*)0) {
-		*buf = free_buf;
+	xfat_buf_t* r_buf = bpool_hash_find(pool, sector_no);
+	if (r_buf != (xfat_buf_t*)0) {
+		// 上层可能改写过sector_no，命中时以索引的扇区号为准
+		r_buf->sector_no = r_buf->hash_sector;
+		bpool_touch_buf(pool, r_buf);
+		pool->stats.hits++;
 	}
 	else {
-		*buf = pool->last;
+		// 未命中，取链表尾部的缓存（空闲缓存总是被放在尾部）
+		r_buf = bpool_get_victim(pool);
+		if (r_buf == (xfat_buf_t*)0) {
+			return FS_ERR_NO_BUFFER;
+		}
+		bpool_insert_buf(pool, r_buf);
+		pool->stats.misses++;
+		if (r_buf->flags & XFAT_BUF_HASHED) {
+			pool->stats.evictions++;
+		}
 	}
 
-	return bpool_moveto_first(pool, *buf);
+	*buf = r_buf;
+	return FS_ERR_OK;
+}
+
+xfat_err_t xfat_bpool_init(xfat_obj_t* obj, u32_t sector_size, u8_t* buffer, u32_t buf_size, xfat_bpool_policy_t policy) {
+	return xfat_bpool_init_part(obj, XFAT_BPOOL_PART_DATA, sector_size, buffer, buf_size, policy);
 }
 
-xfat_err_t xfat_bpool_init(xfat_obj_t* obj, u32_t sector_size, u8_t* buffer, u32_t buf_size) {
-	u32_t buf_count = buf_size / ((sizeof(xfat_buf_t)) + sector_size);
+xfat_err_t xfat_bpool_init_part(xfat_obj_t* obj, xfat_bpool_part_t part, u32_t sector_size,
+	u8_t* buffer, u32_t buf_size, xfat_bpool_policy_t policy) {
+	u32_t buf_count = buf_size / ((sizeof(xfat_buf_t)) + sizeof(xfat_buf_t*) + sector_size);
 	xfat_buf_t* buf_start = (xfat_buf_t*)buffer;
-	u8_t* sector_buf_start = buffer + buf_count * sizeof(xfat_buf_t);
+	xfat_buf_t** hash_tbl = (xfat_buf_t**)(buffer + buf_count * sizeof(xfat_buf_t));
+	u8_t* sector_buf_start = (u8_t*)(hash_tbl + buf_count);
 
-	xfat_bpool_t* pool = get_obj_bpool(obj, 0);
+	xfat_bpool_t* pool = get_obj_part_bpool(obj, part);
 	if (pool == (xfat_bpool_t*)0) {
 		return FS_ERR_PARAM;
 	}
 
+	pool->policy = policy;
+	pool->hot_last = (xfat_buf_t*)0;
+	pool->hot_count = 0;
+	pool->miss_count = 0;
+	pool->pin_count = 0;
+	pool->dirty_count = 0;
+	pool->dirty_ratio = 0;
+	pool->dirty_age = 0;
+	pool->map_mode = 0;
+	pool->map_dirty_start = pool->map_dirty_end = 0;
+	memset(&pool->stats, 0, sizeof(pool->stats));
+	pool->mem = buffer;
+	pool->mem_size = buf_size;
+	pool->mem_alloced = 0;
+	pool->mem_ops = (const xfat_bpool_mem_t*)0;
+
 	if (buf_count == 0) {
 		pool->first = pool->last = (xfat_buf_t*)0;
 		pool->size = 0;
+		pool->hash_tbl = (xfat_buf_t**)0;
+		pool->hash_size = 0;
+		pool->extent_sectors = 1;
 		return FS_ERR_OK;
 	}
 
-	xfat_buf_t* buf = buf_start++;
-	buf->pre = buf->next = buf;
-	buf->buf = sector_buf_start;
-	pool->first = pool->last = buf;
-	sector_buf_start += sector_size;
-
-	for (u32_t i = 1; i < buf_count; i++) {
+	pool->first = pool->last = (xfat_buf_t*)0;
+	for (u32_t i = 0; i < buf_count; i++) {
 		xfat_buf_t* buf = buf_start++;
-		buf->next = pool->first;
-		buf->pre = pool->first->pre;
-
-		buf->next->pre = buf;
-		buf->pre->next = buf;
-		pool->first = buf;
-
 		buf->sector_no = 0;
+		buf->hash_sector = 0;
+		buf->hash_next = (xfat_buf_t*)0;
+		buf->stamp = 0;
+		buf->ref = 0;
+		buf->dirty_stamp = 0;
 		buf->buf = sector_buf_start;
 		buf->flags = XFAT_BUF_STATE_FREE;
+		bpool_link_first(pool, buf);
+
+		hash_tbl[i] = (xfat_buf_t*)0;
 		sector_buf_start += sector_size;
 	}
 
 	pool->size = buf_count;
+	pool->hash_tbl = hash_tbl;
+	pool->hash_size = buf_count;
+	pool->extent_sectors = 1;
 	return FS_ERR_OK;
 }
 
-xfat_err_t xfat_bpool_read_sector(xfat_obj_t* obj, xfat_buf_t** buf, u32_t sector_no) {
-	xfat_bpool_t* pool = get_obj_bpool(obj, 1);
+xfat_err_t xfat_bpool_set_mem(xfat_obj_t* obj, xfat_bpool_part_t part, const xfat_bpool_mem_t* mem_ops) {
+	xfat_bpool_t* pool = get_obj_part_bpool(obj, part);
 	if (pool == (xfat_bpool_t*)0) {
-		return FS_ERR_OK;
+		return FS_ERR_PARAM;
 	}
 
-	xfat_buf_t* r_buf = (xfat_buf_t*)0;
-	u32_t err = bpool_find_buf(pool, sector_no, &r_buf);
-	if (err < 0) {
-		return err;
+	pool->mem_ops = mem_ops;
+	return FS_ERR_OK;
+}
+
+// 在线调整缓存池大小：按LRU顺序将尽量多的缓存迁移到新内存中，只回写放不下的脏缓存
+// buffer为空时从mem_ops分配buf_size字节
+xfat_err_t xfat_bpool_resize(xfat_obj_t* obj, xfat_bpool_part_t part, u8_t* buffer, u32_t buf_size) {
+	xfat_bpool_t* pool = get_obj_part_bpool(obj, part);
+	if (pool == (xfat_bpool_t*)0) {
+		return FS_ERR_PARAM;
 	}
 
-	if (r_buf == (xfat_buf_t*)0) {
-		return FS_ERR_NONE;
+	xfat_err_t io_err = bpool_io_wait_pool(pool);
+	if (io_err < 0) {
+		return io_err;
 	}
 
-	if ((sector_no == r_buf->sector_no) && (xfat_buf_state(r_buf) != XFAT_BUF_STATE_FREE)) {
-		*buf = r_buf;
-		return FS_ERR_OK;
+	// 被固定的缓存仍被调用者引用，不能迁移
+	if (pool->pin_count > 0) {
+		return FS_ERR_NO_BUFFER;
 	}
 
-	switch (xfat_buf_state(r_buf)) {
-	case XFAT_BUF_STATE_FREE:
-	case XFAT_BUF_STATE_CLEAN:
-		break;
-	case XFAT_BUF_STATE_DIRTY:
-		err = xdisk_write_sector(get_obj_disk(obj), r_buf->buf, r_buf->sector_no, 1);
-		if (err < 0) {
-			return err;
+	xdisk_t* disk = get_obj_disk(obj);
+	u32_t sector_size = disk->sector_size;
+	u32_t buf_count = buf_size / ((sizeof(xfat_buf_t)) + sizeof(xfat_buf_t*) + sector_size);
+
+	u8_t alloced = 0;
+	if ((buffer == (u8_t*)0) && (buf_count > 0)) {
+		if (pool->mem_ops == (const xfat_bpool_mem_t*)0) {
+			return FS_ERR_PARAM;
 		}
-		break;
+
+		buffer = pool->mem_ops->alloc(buf_size);
+		if (buffer == (u8_t*)0) {
+			return FS_ERR_MEM;
+		}
+		alloced = 1;
 	}
 
-	err = xdisk_read_sector(get_obj_disk(obj), r_buf->buf, sector_no, 1);
+	// 先回写放不下的脏缓存，它们位于链表尾部；新旧内存重叠时无法迁移，全部回写
+	u32_t keep_count = (pool->size < buf_count) ? pool->size : buf_count;
+	if (!alloced && (buffer < pool->mem + pool->mem_size) && (pool->mem < buffer + buf_size)) {
+		keep_count = 0;
+	}
+	xfat_buf_t* old_buf = pool->last;
+	for (u32_t i = keep_count; i < pool->size; i++) {
+		if (xfat_buf_state(old_buf) == XFAT_BUF_STATE_DIRTY) {
+			xfat_err_t err = xdisk_write_sector(disk, old_buf->buf, old_buf->hash_sector, 1);
+			if (err < 0) {
+				if (alloced) {
+					pool->mem_ops->free(buffer, buf_size);
+				}
+				return err;
+			}
+			bpool_set_state(pool, old_buf, XFAT_BUF_STATE_CLEAN);
+			pool->stats.write_backs++;
+		}
+		if (old_buf->flags & XFAT_BUF_HASHED) {
+			pool->stats.evictions++;
+		}
+		old_buf = old_buf->pre;
+	}
+
+	xfat_bpool_t old_pool = *pool;
+	xfat_err_t err = xfat_bpool_init_part(obj, part, sector_size, buffer, buf_size, old_pool.policy);
 	if (err < 0) {
 		return err;
 	}
+	pool->miss_count = old_pool.miss_count;
+	pool->stats = old_pool.stats;
+	pool->mem_alloced = alloced;
+	pool->mem_ops = old_pool.mem_ops;
+	pool->dirty_ratio = old_pool.dirty_ratio;
+	pool->dirty_age = old_pool.dirty_age;
+	pool->map_mode = old_pool.map_mode;
+	pool->map_dirty_start = old_pool.map_dirty_start;
+	pool->map_dirty_end = old_pool.map_dirty_end;
+	if ((pool->size > 0) && (old_pool.extent_sectors <= pool->size / 2) &&
+		(old_pool.extent_sectors * sector_size <= sizeof(bounce_buf))) {
+		pool->extent_sectors = old_pool.extent_sectors;
+	}
 
-	xfat_buf_set_state(r_buf, XFAT_BUF_STATE_CLEAN);
-	r_buf->sector_no = sector_no;
-	*buf = r_buf;
-	return FS_ERR_OK;
-}
+	// 按原有顺序从头部开始迁移，新缓存池中的空闲缓存已依次排在后面
+	xfat_buf_t* new_buf = pool->first;
+	old_buf = old_pool.first;
+	for (u32_t i = 0; i < keep_count; i++) {
+		if (pool->map_mode && (old_buf->flags & XFAT_BUF_HASHED)) {
+			new_buf->buf = old_buf->buf;
+		}
+		else {
+			memcpy(new_buf->buf, old_buf->buf, sector_size);
+		}
+		new_buf->flags = old_buf->flags & ~XFAT_BUF_HASHED;
+		new_buf->stamp = old_buf->stamp;
+		new_buf->dirty_stamp = old_buf->dirty_stamp;
+		if (xfat_buf_state(new_buf) == XFAT_BUF_STATE_DIRTY) {
+			pool->dirty_count++;
+		}
+		new_buf->sector_no = old_buf->sector_no;
+		if (old_buf->flags & XFAT_BUF_HASHED) {
+			new_buf->sector_no = old_buf->hash_sector;
+			bpool_hash_add(pool, new_buf);
+		}
 
-xfat_err_t xfat_bpool_write_sector(xfat_obj_t* obj, xfat_buf_t* buf, u8_t is_through) {
-	if (is_through) {
-		xfat_err_t	err = xdisk_write_sector(get_obj_disk(obj), buf->buf, buf->sector_no, 1);
-		if (err < 0) {
-			return err;
+		if (new_buf->flags & XFAT_BUF_HOT) {
+			pool->hot_last = new_buf;
+			pool->hot_count++;
 		}
 
-		xfat_buf_set_state(buf, XFAT_BUF_STATE_CLEAN);
+		old_buf = old_buf->next;
+		new_buf = new_buf->next;
 	}
-	else {
-		xfat_buf_set_state(buf, XFAT_BUF_STATE_DIRTY);
+
+	while (pool->hot_count > bpool_hot_max(pool)) {
+		bpool_cool_buf(pool, pool->hot_last);
 	}
 
+	if (old_pool.mem_alloced) {
+		old_pool.mem_ops->free(old_pool.mem, old_pool.mem_size);
+	}
 	return FS_ERR_OK;
 }
 
-xfat_err_t xfat_bpool_alloc(xfat_obj_t* obj, xfat_buf_t** buf, u32_t sector_no) {
-	xfat_bpool_t* pool = get_obj_bpool(obj, 1);
+xfat_err_t xfat_bpool_stats(xfat_obj_t* obj, xfat_bpool_part_t part, xfat_bpool_stats_t* stats, u8_t reset) {
+	xfat_bpool_t* pool = get_obj_part_bpool(obj, part);
 	if (pool == (xfat_bpool_t*)0) {
-		return FS_ERR_OK;
+		return FS_ERR_PARAM;
 	}
 
-	xfat_buf_t* r_buf = (xfat_buf_t*)0;
-	u32_t err = bpool_find_buf(pool, sector_no, &r_buf);
-	if (err < 0) {
-		return err;
+	if (stats != (xfat_bpool_stats_t*)0) {
+		*stats = pool->stats;
 	}
 
-	if (r_buf == (xfat_buf_t*)0) {
-		return FS_ERR_NONE;
+	if (reset) {
+		memset(&pool->stats, 0, sizeof(pool->stats));
 	}
+	return FS_ERR_OK;
+}
 
-	if ((sector_no == r_buf->sector_no) && (xfat_buf_state(r_buf) != XFAT_BUF_STATE_FREE)) {
-		*buf = r_buf;
-		return FS_ERR_OK;
+xfat_err_t xfat_bpool_set_extent(xfat_obj_t* obj, u32_t sector_count) {
+	xfat_bpool_t* pool = get_obj_bpool(obj, 0);
+	if ((pool == (xfat_bpool_t*)0) || (sector_count == 0)) {
+		return FS_ERR_PARAM;
 	}
 
-	switch (xfat_buf_state(r_buf)) {
-	case XFAT_BUF_STATE_FREE:
-	case XFAT_BUF_STATE_CLEAN:
-		break;
-	case XFAT_BUF_STATE_DIRTY:
-		err = xdisk_write_sector(get_obj_disk(obj), r_buf->buf, r_buf->sector_no, 1);
-		if (err < 0) {
-			return err;
-		}
-		break;
+	// 一次填充的扇区不能超过中转缓冲，也不能挤掉缓存池中过多的其它扇区
+	xdisk_t* disk = get_obj_disk(obj);
+	if ((sector_count * disk->sector_size > sizeof(bounce_buf)) || (sector_count > pool->size / 2)) {
+		return FS_ERR_PARAM;
 	}
 
-	xfat_buf_set_state(r_buf, XFAT_BUF_STATE_FREE);
-	r_buf->sector_no = sector_no;
-	*buf = r_buf;
+	pool->extent_sectors = sector_count;
 	return FS_ERR_OK;
 }
 
-xfat_err_t xfat_bpool_flush(xfat_obj_t* obj) {
-	xfat_bpool_t* pool = get_obj_bpool(obj, 1);
-	u32_t size = pool->size;
-
-	if (pool == (xfat_bpool_t*)0) {
-		return FS_ERR_PARAM;
+// 去掉[start_sector, start_sector + count)两端已缓存的扇区
+static void bpool_trim_cached(xfat_bpool_t* pool, u32_t* start_sector, u32_t* count) {
+	while ((*count > 0) && (bpool_hash_find(pool, *start_sector) != (xfat_buf_t*)0)) {
+		(*start_sector)++;
+		(*count)--;
 	}
+	while ((*count > 0) && (bpool_hash_find(pool, *start_sector + *count - 1) != (xfat_buf_t*)0)) {
+		(*count)--;
+	}
+}
 
-	xfat_buf_t* cur_buf = pool->first;
-	while (size--) {
-		switch (xfat_buf_state(cur_buf)) {
-		case XFAT_BUF_STATE_FREE:
-		case XFAT_BUF_STATE_CLEAN:
-		{
+// 将已从磁盘读入data的count个扇区放入缓存池，已缓存的扇区保持不变
+static xfat_err_t bpool_fill_sectors(xdisk_t* disk, xfat_bpool_t* pool, u32_t start_sector, u32_t count, u8_t* data) {
+	for (u32_t i = 0; i < count; i++) {
+		u32_t curr_sector = start_sector + i;
+		if (bpool_hash_find(pool, curr_sector) != (xfat_buf_t*)0) {
+			continue;
+		}
+
+		// 全部被固定时，余下的扇区不再读入
+		xfat_buf_t* victim = bpool_get_victim(pool);
+		if (victim == (xfat_buf_t*)0) {
 			break;
 		}
-		case XFAT_BUF_STATE_DIRTY:
-		{
-			xfat_err_t err = xdisk_write_sector(get_obj_disk(obj), cur_buf->buf, cur_buf->sector_no, 1);
+		if (xfat_buf_state(victim) == XFAT_BUF_STATE_DIRTY) {
+			xfat_err_t err = xdisk_write_sector(disk, victim->buf, victim->hash_sector, 1);
 			if (err < 0) {
 				return err;
 			}
-			xfat_buf_set_state(cur_buf, XFAT_BUF_STATE_CLEAN);
-			break;
+			pool->stats.write_backs++;
 		}
+		if (victim->flags & XFAT_BUF_HASHED) {
+			pool->stats.evictions++;
 		}
-		cur_buf = cur_buf->next;
+
+		bpool_hash_remove(pool, victim);
+		memcpy(victim->buf, data + i * disk->sector_size, disk->sector_size);
+		bpool_set_state(pool, victim, XFAT_BUF_STATE_CLEAN);
+		victim->sector_no = curr_sector;
+		bpool_hash_add(pool, victim);
+		bpool_insert_buf(pool, victim);
+		victim->flags |= XFAT_BUF_PREFETCHED;
 	}
 
 	return FS_ERR_OK;
 }
 
-xfat_err_t xfat_bpool_flush_sectors(xfat_obj_t* obj, u32_t start_sector, u32_t count) {
-	xfat_bpool_t* pool = get_obj_bpool(obj, 1);
-	u32_t size = pool->size;
+// 用一次磁盘读取将[start_sector, start_sector + count)中未缓存的扇区读入缓存池，已缓存的扇区保持不变
+static xfat_err_t bpool_fill_range(xfat_obj_t* obj, xfat_bpool_t* pool, u32_t start_sector, u32_t count) {
+	xdisk_t* disk = get_obj_disk(obj);
 
-	if (pool == (xfat_bpool_t*)0) {
-		return FS_ERR_PARAM;
+	bpool_trim_cached(pool, &start_sector, &count);
+	if (count == 0) {
+		return FS_ERR_OK;
 	}
 
-	u32_t end_sector = start_sector + count - 1;
-	xfat_buf_t* cur_buf = pool->first;
-	while (size--) {
-		switch (xfat_buf_state(cur_buf)) {
-		case XFAT_BUF_STATE_FREE:
-		case XFAT_BUF_STATE_CLEAN:
-		{
-			break;
-		}
-		case XFAT_BUF_STATE_DIRTY:
-		{
-			if ((cur_buf->sector_no >= start_sector) && (cur_buf->sector_no <= end_sector)) {
-				xfat_err_t err = xdisk_write_sector(get_obj_disk(obj), cur_buf->buf, cur_buf->sector_no, 1);
-				if (err < 0) {
-					return err;
-				}
-				xfat_buf_set_state(cur_buf, XFAT_BUF_STATE_CLEAN);
-			}
-			break;
-		}
-		}
-		cur_buf = cur_buf->next;
+	xfat_err_t err = xdisk_read_sector(disk, bounce_buf, start_sector, count);
+	if (err < 0) {
+		return err;
 	}
 
-	return FS_ERR_OK;
+	return bpool_fill_sectors(disk, pool, start_sector, count, bounce_buf);
 }
 
-xfat_err_t xfat_bpool_invalid_sectors(xfat_obj_t* obj, u32_t start_sector, u32_t count) {
-	xfat_bpool_t* pool = get_obj_bpool(obj, 1);
-	u32_t size = pool->size;
-
-	if (pool == (xfat_bpool_t*)0) {
-		return FS_ERR_PARAM;
+/**
+ * 等待已批量提交的请求全部完成。读入的扇区放入各自的缓存池，预读只是尽力而为，读失败时直接舍弃；
+ * 写失败的扇区重新标记为脏，返回第一个写错误
+ */
+static xfat_err_t bpool_io_wait(void) {
+	if (io_batch.count == 0) {
+		return FS_ERR_OK;
 	}
 
-	u32_t end_sector = start_sector + count - 1;
-	xfat_buf_t* cur_buf = pool->first;
-	while (size--) {
-		switch (xfat_buf_state(cur_buf)) {
-		case XFAT_BUF_STATE_FREE:
-		case XFAT_BUF_STATE_CLEAN:
-		{
-			break;
+	xdisk_t* disk = io_batch.disk;
+	xfat_err_t err = xdisk_poll(disk, 1);
+	xfat_err_t r_err = (err < 0) ? err : FS_ERR_OK;
+
+	for (u32_t i = 0; i < io_batch.count; i++) {
+		bpool_io_t* bio = io_batch.io + i;
+		xfat_bpool_t* pool = bio->pool;
+
+		if (bio->io.is_write) {
+			if (bio->io.err < 0) {
+				for (u32_t j = 0; j < bio->io.count; j++) {
+					xfat_buf_t* buf = bpool_hash_find(pool, bio->io.start_sector + j);
+					if ((buf != (xfat_buf_t*)0) && (xfat_buf_state(buf) == XFAT_BUF_STATE_CLEAN)) {
+						bpool_set_state(pool, buf, XFAT_BUF_STATE_DIRTY);
+					}
+				}
+				pool->stats.write_backs -= bio->io.count;
+
+				if (r_err == FS_ERR_OK) {
+					r_err = bio->io.err;
+				}
+			}
+		}
+		else if (bio->io.err == FS_ERR_OK) {
+			err = bpool_fill_sectors(disk, pool, bio->io.start_sector, bio->io.count, bio->io.buffer);
+			if ((err < 0) && (r_err == FS_ERR_OK)) {
+				r_err = err;
+			}
+		}
+	}
+
+	io_batch.disk = (xdisk_t*)0;
+	io_batch.count = 0;
+	io_batch.bounce_used = 0;
+	io_batch.iov_used = 0;
+	return r_err;
+}
+
+// 为下一个请求预留位置、size字节的中转缓冲及iov_count个缓冲区段，批次已满、空间不足或换了磁盘时先等待当前批次完成
+static xfat_err_t bpool_io_reserve(xdisk_t* disk, u32_t size, u32_t iov_count, u8_t** data, xdisk_iovec_t** iov) {
+	if ((io_batch.count > 0) && ((io_batch.disk != disk) || (io_batch.count >= XFAT_BUF_IO_MAX) ||
+		(io_batch.bounce_used + size > sizeof(io_bounce_buf)) ||
+		(io_batch.iov_used + iov_count > sizeof(io_iov) / sizeof(io_iov[0])))) {
+		xfat_err_t err = bpool_io_wait();
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	io_batch.disk = disk;
+	if (size > 0) {
+		*data = io_bounce_buf + io_batch.bounce_used;
+		io_batch.bounce_used += size;
+	}
+	if (iov_count > 0) {
+		*iov = io_iov + io_batch.iov_used;
+		io_batch.iov_used += iov_count;
+	}
+	return FS_ERR_OK;
+}
+
+// 提交已预留位置的请求，iov_count非0时读写iov中的各段。结果由bpool_io_wait统一处理
+static void bpool_io_submit(xfat_bpool_t* pool, u8_t is_write, u8_t* data, xdisk_iovec_t* iov, u32_t iov_count,
+	u32_t start_sector, u32_t count) {
+	bpool_io_t* bio = io_batch.io + io_batch.count++;
+	bio->pool = pool;
+	bio->io.is_write = is_write;
+	bio->io.buffer = data;
+	bio->io.iov = iov;
+	bio->io.iov_count = iov_count;
+	bio->io.start_sector = start_sector;
+	bio->io.count = count;
+	bio->io.next = (xdisk_io_t*)0;
+	xdisk_submit(io_batch.disk, &bio->io);
+}
+
+// 只在批次中有该缓存池的请求时才等待，其它缓存池的预读可继续进行
+static xfat_err_t bpool_io_wait_pool(xfat_bpool_t* pool) {
+	for (u32_t i = 0; i < io_batch.count; i++) {
+		if (io_batch.io[i].pool == pool) {
+			return bpool_io_wait();
+		}
+	}
+	return FS_ERR_OK;
+}
+
+xfat_err_t xfat_bpool_wait(xfat_obj_t* obj) {
+	if (io_batch.disk != get_obj_disk(obj)) {
+		return FS_ERR_OK;
+	}
+	return bpool_io_wait();
+}
+
+// 未命中时，用一次磁盘读取填充sector_no所在的整个对齐区段
+static xfat_err_t bpool_read_extent(xfat_obj_t* obj, xfat_bpool_t* pool, xfat_buf_t** buf, u32_t sector_no) {
+	xdisk_t* disk = get_obj_disk(obj);
+	u32_t start_sector = sector_no - sector_no % pool->extent_sectors;
+	u32_t count = pool->extent_sectors;
+
+	if (((u64_t)start_sector + count > disk->total_sector) || (count > bpool_fill_max(pool))) {
+		start_sector = sector_no;
+		count = 1;
+	}
+
+	xfat_err_t err = bpool_fill_range(obj, pool, start_sector, count);
+	if (err < 0) {
+		return err;
+	}
+
+	xfat_buf_t* r_buf = bpool_hash_find(pool, sector_no);
+	if (r_buf == (xfat_buf_t*)0) {
+		return FS_ERR_NO_BUFFER;
+	}
+	bpool_touch_buf(pool, r_buf);
+	*buf = r_buf;
+	return FS_ERR_OK;
+}
+
+u32_t xfat_bpool_prefetch_max(xfat_obj_t* obj) {
+	xfat_bpool_t* pool = get_obj_bpool(obj, 1);
+	if ((pool == (xfat_bpool_t*)0) || (pool->size < 2)) {
+		return 0;
+	}
+
+	return bpool_fill_max(pool);
+}
+
+xfat_err_t xfat_bpool_prefetch(xfat_obj_t* obj, u32_t start_sector, u32_t count) {
+	xfat_bpool_t* pool = get_sector_bpool(obj, start_sector);
+	if ((pool == (xfat_bpool_t*)0) || (pool->size < 2) || pool->map_mode) {
+		return FS_ERR_OK;
+	}
+
+	// 预读只是尽力而为，超出缓存池容纳能力的部分直接舍弃
+	if (count > bpool_fill_max(pool)) {
+		count = bpool_fill_max(pool);
+	}
+
+	xdisk_t* disk = get_obj_disk(obj);
+	u32_t max_count = sizeof(io_bounce_buf) / disk->sector_size;
+
+	if ((u64_t)start_sector + count > disk->total_sector) {
+		count = (start_sector < disk->total_sector) ? disk->total_sector - start_sector : 0;
+	}
+
+	// 各段读请求批量提交后即返回，由下次访问缓存池或xfat_bpool_wait收取
+	while (count > 0) {
+		u32_t curr_count = (count > max_count) ? max_count : count;
+		u32_t read_start = start_sector;
+		u32_t read_count = curr_count;
+		bpool_trim_cached(pool, &read_start, &read_count);
+		if (read_count > 0) {
+			u8_t* data;
+			xfat_err_t err = bpool_io_reserve(disk, read_count * disk->sector_size, 0, &data, (xdisk_iovec_t**)0);
+			if (err < 0) {
+				return err;
+			}
+			bpool_io_submit(pool, 0, data, (xdisk_iovec_t*)0, 0, read_start, read_count);
+		}
+
+		start_sector += curr_count;
+		count -= curr_count;
+	}
+
+	return FS_ERR_OK;
+}
+
+// 直通模式下的读取及分配：缓存直接指向磁盘映射中的扇区，未命中时无需读盘
+static xfat_err_t bpool_map_sector(xfat_obj_t* obj, xfat_bpool_t* pool, xfat_buf_t** buf, u32_t sector_no) {
+	xfat_buf_t* r_buf = (xfat_buf_t*)0;
+	xfat_err_t err = bpool_find_buf(pool, sector_no, &r_buf);
+	if (err < 0) {
+		return err;
+	}
+
+	if ((r_buf->flags & XFAT_BUF_HASHED) && (sector_no == r_buf->hash_sector)) {
+		*buf = r_buf;
+		return FS_ERR_OK;
+	}
+
+	u8_t* map = xdisk_map_sector(get_obj_disk(obj), sector_no, 1);
+	if (map == (u8_t*)0) {
+		bpool_discard_buf(pool, r_buf);
+		return FS_ERR_PARAM;
+	}
+
+	bpool_hash_remove(pool, r_buf);
+	r_buf->buf = map;
+	r_buf->sector_no = sector_no;
+	bpool_set_state(pool, r_buf, XFAT_BUF_STATE_CLEAN);
+	bpool_hash_add(pool, r_buf);
+	*buf = r_buf;
+	return FS_ERR_OK;
+}
+
+xfat_err_t xfat_bpool_read_sector(xfat_obj_t* obj, xfat_buf_t** buf, u32_t sector_no) {
+	xfat_bpool_t* pool = get_sector_bpool(obj, sector_no);
+	if (pool == (xfat_bpool_t*)0) {
+		return FS_ERR_OK;
+	}
+
+	// 先收取该缓存池尚未完成的预读等批量请求，之后缓存池的状态才是完整的
+	xfat_err_t io_err = bpool_io_wait_pool(pool);
+	if (io_err < 0) {
+		return io_err;
+	}
+
+	if (pool->map_mode) {
+		return bpool_map_sector(obj, pool, buf, sector_no);
+	}
+
+	if ((pool->extent_sectors > 1) && (bpool_hash_find(pool, sector_no) == (xfat_buf_t*)0)) {
+		pool->stats.misses++;
+		return bpool_read_extent(obj, pool, buf, sector_no);
+	}
+
+	xfat_buf_t* r_buf = (xfat_buf_t*)0;
+	xfat_err_t err = bpool_find_buf(pool, sector_no, &r_buf);
+	if (err < 0) {
+		return err;
+	}
+
+	if (r_buf == (xfat_buf_t*)0) {
+		return FS_ERR_NONE;
+	}
+
+	if ((r_buf->flags & XFAT_BUF_HASHED) && (sector_no == r_buf->hash_sector)) {
+		*buf = r_buf;
+		return FS_ERR_OK;
+	}
+
+	switch (xfat_buf_state(r_buf)) {
+	case XFAT_BUF_STATE_FREE:
+	case XFAT_BUF_STATE_CLEAN:
+		break;
+	case XFAT_BUF_STATE_DIRTY:
+		err = xdisk_write_sector(get_obj_disk(obj), r_buf->buf, r_buf->hash_sector, 1);
+		if (err < 0) {
+			return err;
+		}
+		pool->stats.write_backs++;
+		break;
+	}
+
+	bpool_hash_remove(pool, r_buf);
+	bpool_set_state(pool, r_buf, XFAT_BUF_STATE_FREE);
+
+	err = xdisk_read_sector(get_obj_disk(obj), r_buf->buf, sector_no, 1);
+	if (err < 0) {
+		bpool_discard_buf(pool, r_buf);
+		return err;
+	}
+
+	bpool_set_state(pool, r_buf, XFAT_BUF_STATE_CLEAN);
+	r_buf->sector_no = sector_no;
+	bpool_hash_add(pool, r_buf);
+	*buf = r_buf;
+	return FS_ERR_OK;
+}
+
+// 直通模式下写入：数据已在映射中，只记录待同步的范围；写穿时立即同步该扇区
+// 调用者改写了sector_no时（如FAT镜像表），先将内容拷贝到新扇区在映射中的位置
+static xfat_err_t bpool_map_write(xfat_obj_t* obj, xfat_bpool_t* pool, xfat_buf_t* buf, u8_t is_through) {
+	xdisk_t* disk = get_obj_disk(obj);
+	u8_t* map = xdisk_map_sector(disk, buf->sector_no, 1);
+	if (map == (u8_t*)0) {
+		return FS_ERR_PARAM;
+	}
+
+	if (buf->buf != map) {
+		memcpy(map, buf->buf, disk->sector_size);
+		buf->buf = map;
+	}
+	bpool_rehash_buf(pool, buf);
+	bpool_set_state(pool, buf, XFAT_BUF_STATE_CLEAN);
+
+	if (is_through) {
+		pool->stats.write_throughs++;
+		return xdisk_sync_sector(disk, buf->sector_no, 1);
+	}
+
+	if (pool->map_dirty_start >= pool->map_dirty_end) {
+		pool->map_dirty_start = buf->sector_no;
+		pool->map_dirty_end = buf->sector_no + 1;
+	}
+	else if (buf->sector_no < pool->map_dirty_start) {
+		pool->map_dirty_start = buf->sector_no;
+	}
+	else if (buf->sector_no >= pool->map_dirty_end) {
+		pool->map_dirty_end = buf->sector_no + 1;
+	}
+	return FS_ERR_OK;
+}
+
+xfat_err_t xfat_bpool_write_sector(xfat_obj_t* obj, xfat_buf_t* buf, u8_t is_through) {
+	xfat_bpool_t* pool = get_sector_bpool(obj, buf->sector_no);
+	if ((pool == (xfat_bpool_t*)0) || (pool->size == 0)) {
+		// 没有缓存池时无人负责回写，直接写入磁盘
+		xfat_err_t err = xdisk_write_sector(get_obj_disk(obj), buf->buf, buf->sector_no, 1);
+		if (err < 0) {
+			return err;
+		}
+
+		xfat_buf_set_state(buf, XFAT_BUF_STATE_CLEAN);
+		return FS_ERR_OK;
+	}
+
+	xfat_err_t io_err = bpool_io_wait_pool(pool);
+	if (io_err < 0) {
+		return io_err;
+	}
+
+	if (pool->map_mode) {
+		return bpool_map_write(obj, pool, buf, is_through);
+	}
+
+	bpool_rehash_buf(pool, buf);
+
+	if (is_through) {
+		xfat_err_t	err = xdisk_write_sector(get_obj_disk(obj), buf->buf, buf->sector_no, 1);
+		if (err < 0) {
+			return err;
+		}
+
+		pool->stats.write_throughs++;
+		bpool_set_state(pool, buf, XFAT_BUF_STATE_CLEAN);
+	}
+	else {
+		bpool_set_state(pool, buf, XFAT_BUF_STATE_DIRTY);
+
+		// 脏缓存超过比例时，由写者回写最冷的脏缓存，读路径上的替换对象因此大多是干净的
+		if ((pool->dirty_ratio > 0) && (pool->dirty_count > bpool_dirty_max(pool))) {
+			return bpool_writeback(obj, pool);
+		}
+	}
+
+	return FS_ERR_OK;
+}
+
+// 固定缓存：在unpin之前该缓存不会被替换，期间可继续调用其它缓存池接口
+// 至少留一个未固定的缓存供替换，缓存池太小时返回FS_ERR_NO_BUFFER，调用者需之后重新读取
+xfat_err_t xfat_bpool_pin(xfat_obj_t* obj, xfat_buf_t* buf) {
+	xfat_bpool_t* pool = get_sector_bpool(obj, buf->sector_no);
+	if (pool == (xfat_bpool_t*)0) {
+		return FS_ERR_PARAM;
+	}
+
+	if ((buf->ref == 0) && (pool->pin_count + 1 >= pool->size)) {
+		return FS_ERR_NO_BUFFER;
+	}
+
+	if (buf->ref++ == 0) {
+		pool->pin_count++;
+	}
+	return FS_ERR_OK;
+}
+
+void xfat_bpool_unpin(xfat_obj_t* obj, xfat_buf_t* buf) {
+	xfat_bpool_t* pool = get_sector_bpool(obj, buf->sector_no);
+	if ((pool == (xfat_bpool_t*)0) || (buf->ref == 0)) {
+		return;
+	}
+
+	if (--buf->ref == 0) {
+		pool->pin_count--;
+	}
+}
+
+xfat_err_t xfat_bpool_alloc(xfat_obj_t* obj, xfat_buf_t** buf, u32_t sector_no) {
+	xfat_bpool_t* pool = get_sector_bpool(obj, sector_no);
+	if (pool == (xfat_bpool_t*)0) {
+		return FS_ERR_OK;
+	}
+
+	xfat_err_t io_err = bpool_io_wait_pool(pool);
+	if (io_err < 0) {
+		return io_err;
+	}
+
+	if (pool->map_mode) {
+		return bpool_map_sector(obj, pool, buf, sector_no);
+	}
+
+	xfat_buf_t* r_buf = (xfat_buf_t*)0;
+	xfat_err_t err = bpool_find_buf(pool, sector_no, &r_buf);
+	if (err < 0) {
+		return err;
+	}
+
+	if (r_buf == (xfat_buf_t*)0) {
+		return FS_ERR_NONE;
+	}
+
+	if ((r_buf->flags & XFAT_BUF_HASHED) && (sector_no == r_buf->hash_sector)) {
+		*buf = r_buf;
+		return FS_ERR_OK;
+	}
+
+	switch (xfat_buf_state(r_buf)) {
+	case XFAT_BUF_STATE_FREE:
+	case XFAT_BUF_STATE_CLEAN:
+		break;
+	case XFAT_BUF_STATE_DIRTY:
+		err = xdisk_write_sector(get_obj_disk(obj), r_buf->buf, r_buf->hash_sector, 1);
+		if (err < 0) {
+			return err;
 		}
-		case XFAT_BUF_STATE_DIRTY:
-		{
-			if ((cur_buf->sector_no >= start_sector) && (cur_buf->sector_no <= end_sector)) {
-				xfat_buf_set_state(cur_buf, XFAT_BUF_STATE_FREE);
+		pool->stats.write_backs++;
+		break;
+	}
+
+	bpool_hash_remove(pool, r_buf);
+	bpool_set_state(pool, r_buf, XFAT_BUF_STATE_FREE);
+	r_buf->sector_no = sector_no;
+	*buf = r_buf;
+	return FS_ERR_OK;
+}
+
+// 是否为连续脏扇区的起始：前一个扇区不在缓存中、不脏或不在回写范围内
+static int bpool_is_run_start(xfat_bpool_t* pool, xfat_buf_t* buf, u32_t start_sector) {
+	if (buf->hash_sector <= start_sector) {
+		return 1;
+	}
+
+	xfat_buf_t* pre = bpool_hash_find(pool, buf->hash_sector - 1);
+	return (pre == (xfat_buf_t*)0) || (xfat_buf_state(pre) != XFAT_BUF_STATE_DIRTY);
+}
+
+// 从buf开始，通过哈希索引收集扇区号连续的脏缓存，拷贝到中转缓冲后合并为一次写
+static xfat_err_t bpool_flush_run(xfat_obj_t* obj, xfat_bpool_t* pool, xfat_buf_t* buf, u32_t end_sector) {
+	xdisk_t* disk = get_obj_disk(obj);
+	u8_t vector = xdisk_has_vector_io(disk);
+	u32_t max_count = vector ? XFAT_BUF_IO_IOV_MAX : sizeof(io_bounce_buf) / disk->sector_size;
+
+	while (buf != (xfat_buf_t*)0) {
+		u32_t start_sector = buf->hash_sector;
+		u32_t count = 0;
+		xfat_buf_t* next = buf;
+		while ((next != (xfat_buf_t*)0) && (xfat_buf_state(next) == XFAT_BUF_STATE_DIRTY) &&
+			(next->hash_sector <= end_sector) && ((count == 0) || (count < max_count))) {
+			count++;
+			next = (start_sector + count > start_sector) ? bpool_hash_find(pool, start_sector + count) : (xfat_buf_t*)0;
+		}
+
+		// 单个扇区直接写缓存本身。多个扇区时，驱动支持聚集写则各缓存作为一段直接写出，
+		// 否则拷贝到中转缓冲合并为一次写。请求只提交不等待，扇区先标记为干净，写失败时由bpool_io_wait恢复为脏
+		u8_t* data = buf->buf;
+		xdisk_iovec_t* iov = (xdisk_iovec_t*)0;
+		u32_t iov_count = 0;
+		u8_t gather = (count > 1) && vector;
+		xfat_err_t err = bpool_io_reserve(disk, ((count > 1) && !vector) ? count * disk->sector_size : 0,
+			gather ? count : 0, &data, &iov);
+		if (err < 0) {
+			return err;
+		}
+
+		for (u32_t i = 0; i < count; i++) {
+			xfat_buf_t* curr_buf = bpool_hash_find(pool, start_sector + i);
+			if (gather) {
+				// 内存中也相邻的缓存合并为一段
+				if ((iov_count > 0) && (iov[iov_count - 1].buffer + iov[iov_count - 1].size == curr_buf->buf)) {
+					iov[iov_count - 1].size += disk->sector_size;
+				}
+				else {
+					iov[iov_count].buffer = curr_buf->buf;
+					iov[iov_count++].size = disk->sector_size;
+				}
+			}
+			else if (count > 1) {
+				memcpy(data + i * disk->sector_size, curr_buf->buf, disk->sector_size);
 			}
+			bpool_set_state(pool, curr_buf, XFAT_BUF_STATE_CLEAN);
+		}
+		pool->stats.write_backs += count;
+		bpool_io_submit(pool, 1, data, iov, iov_count, start_sector, count);
+
+		if ((next != (xfat_buf_t*)0) && (xfat_buf_state(next) == XFAT_BUF_STATE_DIRTY) && (next->hash_sector <= end_sector)) {
+			buf = next;
+		}
+		else {
+			buf = (xfat_buf_t*)0;
+		}
+	}
+
+	return FS_ERR_OK;
+}
+
+// 回写脏缓存：从链表尾部即最先被替换的缓存开始，脏缓存超过比例时回写到比例的一半，
+// 另外回写变脏后经过dirty_age次未命中仍未回写的缓存。连续的脏扇区合并为一次写
+static xfat_err_t bpool_writeback(xfat_obj_t* obj, xfat_bpool_t* pool) {
+	u8_t over_ratio = (pool->dirty_ratio > 0) && (pool->dirty_count > bpool_dirty_max(pool));
+	xfat_buf_t* buf = pool->last;
+	for (u32_t i = 0; (i < pool->size) && (pool->dirty_count > 0); i++, buf = buf->pre) {
+		if (over_ratio && (pool->dirty_count <= bpool_dirty_max(pool) / 2)) {
+			over_ratio = 0;
+		}
+		if (!over_ratio && (pool->dirty_age == 0)) {
 			break;
 		}
+
+		if ((xfat_buf_state(buf) != XFAT_BUF_STATE_DIRTY) ||
+			(!over_ratio && (pool->miss_count - buf->dirty_stamp < pool->dirty_age))) {
+			continue;
+		}
+
+		xfat_buf_t* start_buf = buf;
+		while (!bpool_is_run_start(pool, start_buf, 0)) {
+			start_buf = bpool_hash_find(pool, start_buf->hash_sector - 1);
+		}
+
+		xfat_err_t err = bpool_flush_run(obj, pool, start_buf, 0xFFFFFFFF);
+		if (err < 0) {
+			bpool_io_wait();
+			return err;
+		}
+	}
+
+	return bpool_io_wait();
+}
+
+xfat_err_t xfat_bpool_set_writeback(xfat_obj_t* obj, xfat_bpool_part_t part, u32_t dirty_ratio, u32_t dirty_age) {
+	xfat_bpool_t* pool = get_obj_part_bpool(obj, part);
+	if ((pool == (xfat_bpool_t*)0) || (dirty_ratio > 100)) {
+		return FS_ERR_PARAM;
+	}
+
+	pool->dirty_ratio = dirty_ratio;
+	pool->dirty_age = dirty_age;
+	return FS_ERR_OK;
+}
+
+/**
+ * 设置缓存池的替换策略，切换到LRU时热区中的缓存全部并入普通链表，缓存内容不受影响
+ */
+xfat_err_t xfat_bpool_set_policy(xfat_obj_t* obj, xfat_bpool_part_t part, xfat_bpool_policy_t policy) {
+	xfat_bpool_t* pool = get_obj_part_bpool(obj, part);
+	if ((pool == (xfat_bpool_t*)0) || ((policy != XFAT_BPOOL_LRU) && (policy != XFAT_BPOOL_2Q))) {
+		return FS_ERR_PARAM;
+	}
+
+	if (policy == XFAT_BPOOL_LRU) {
+		xfat_buf_t* buf_start = (xfat_buf_t*)pool->mem;
+		for (u32_t i = 0; i < pool->size; i++) {
+			buf_start[i].flags &= ~XFAT_BUF_HOT;
+		}
+		pool->hot_last = (xfat_buf_t*)0;
+		pool->hot_count = 0;
+	}
+
+	pool->policy = policy;
+	return FS_ERR_OK;
+}
+
+// 供空闲任务周期性调用，提前回写对象各缓存池中过多或过旧的脏缓存
+xfat_err_t xfat_bpool_writeback(xfat_obj_t* obj) {
+	xfat_bpool_t* pool = get_obj_bpool(obj, 1);
+	if (pool == (xfat_bpool_t*)0) {
+		return FS_ERR_PARAM;
+	}
+
+	xfat_err_t io_err = bpool_io_wait();
+	if (io_err < 0) {
+		return io_err;
+	}
+
+	if (obj->type == XFAT_OBJ_FAT) {
+		xfat_t* xfat = to_type(obj, xfat_t);
+		xfat_err_t err = bpool_writeback(obj, &xfat->fat_bpool);
+		if (err < 0) {
+			return err;
+		}
+
+		err = bpool_writeback(obj, &xfat->dir_bpool);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	return bpool_writeback(obj, pool);
+}
+
+xfat_err_t xfat_bpool_flush(xfat_obj_t* obj) {
+	return xfat_bpool_flush_sectors(obj, 0, 0xFFFFFFFF);
+}
+
+static xfat_err_t bpool_flush_sectors(xfat_obj_t* obj, xfat_bpool_t* pool, u32_t start_sector, u32_t count) {
+	u32_t size = pool->size;
+	if (size == 0) {
+		return FS_ERR_OK;
+	}
+
+	pool->stats.flushes++;
+	u32_t end_sector = (start_sector + count - 1 < start_sector) ? 0xFFFFFFFF : start_sector + count - 1;
+
+	// 直通模式下没有脏缓存，与回写范围有重叠时同步整个待同步范围
+	if (pool->map_mode) {
+		if ((pool->map_dirty_start < pool->map_dirty_end) &&
+			(pool->map_dirty_start <= end_sector) && (pool->map_dirty_end > start_sector)) {
+			xfat_err_t err = xdisk_sync_sector(get_obj_disk(obj), pool->map_dirty_start,
+				pool->map_dirty_end - pool->map_dirty_start);
+			if (err < 0) {
+				return err;
+			}
+			pool->map_dirty_start = pool->map_dirty_end = 0;
+		}
+		return FS_ERR_OK;
+	}
+
+	// 范围较小时直接查哈希表，避免遍历整个缓存池
+	if ((count <= size) && (end_sector >= start_sector)) {
+		for (u32_t i = 0; i < count; i++) {
+			xfat_buf_t* buf = bpool_hash_find(pool, start_sector + i);
+			if ((buf != (xfat_buf_t*)0) && (xfat_buf_state(buf) == XFAT_BUF_STATE_DIRTY)) {
+				xfat_err_t err = bpool_flush_run(obj, pool, buf, end_sector);
+				if (err < 0) {
+					bpool_io_wait();
+					return err;
+				}
+			}
+		}
+		return bpool_io_wait();
+	}
+	xfat_buf_t* cur_buf = pool->first;
+	while (size--) {
+		if ((xfat_buf_state(cur_buf) == XFAT_BUF_STATE_DIRTY) &&
+			(cur_buf->hash_sector >= start_sector) && (cur_buf->hash_sector <= end_sector) &&
+			bpool_is_run_start(pool, cur_buf, start_sector)) {
+			xfat_err_t err = bpool_flush_run(obj, pool, cur_buf, end_sector);
+			if (err < 0) {
+				bpool_io_wait();
+				return err;
+			}
 		}
 		cur_buf = cur_buf->next;
 	}
 
+	return bpool_io_wait();
+}
+
+xfat_err_t xfat_bpool_flush_sectors(xfat_obj_t* obj, u32_t start_sector, u32_t count) {
+	xfat_bpool_t* pool = get_obj_bpool(obj, 1);
+	if (pool == (xfat_bpool_t*)0) {
+		return FS_ERR_PARAM;
+	}
+
+	xfat_err_t io_err = bpool_io_wait();
+	if (io_err < 0) {
+		return io_err;
+	}
+
+	if (obj->type == XFAT_OBJ_FAT) {
+		xfat_t* xfat = to_type(obj, xfat_t);
+		xfat_err_t err = bpool_flush_sectors(obj, &xfat->fat_bpool, start_sector, count);
+		if (err < 0) {
+			return err;
+		}
+
+		err = bpool_flush_sectors(obj, &xfat->dir_bpool, start_sector, count);
+		if (err < 0) {
+			return err;
+		}
+	}
+
+	return bpool_flush_sectors(obj, pool, start_sector, count);
+}
+
+static xfat_err_t bpool_invalid_sectors(xfat_bpool_t* pool, u32_t start_sector, u32_t count) {
+	if (pool->size == 0) {
+		return FS_ERR_OK;
+	}
+
+	// 范围较小时直接查哈希表，避免遍历整个缓存池
+	if (count <= pool->size) {
+		for (u32_t i = 0; i < count; i++) {
+			xfat_buf_t* buf = bpool_hash_find(pool, start_sector + i);
+			if (buf != (xfat_buf_t*)0) {
+				bpool_discard_buf(pool, buf);
+			}
+		}
+		return FS_ERR_OK;
+	}
+
+	u32_t size = pool->size;
+	u32_t end_sector = start_sector + count - 1;
+	xfat_buf_t* cur_buf = pool->first;
+	while (size--) {
+		xfat_buf_t* next_buf = cur_buf->next;
+		if ((cur_buf->flags & XFAT_BUF_HASHED) &&
+			(cur_buf->hash_sector >= start_sector) && (cur_buf->hash_sector <= end_sector)) {
+			bpool_discard_buf(pool, cur_buf);
+		}
+		cur_buf = next_buf;
+	}
+
 	return FS_ERR_OK;
-}
\ No newline at end of file
+}
+
+xfat_err_t xfat_bpool_invalid_sectors(xfat_obj_t* obj, u32_t start_sector, u32_t count) {
+	xfat_bpool_t* pool = get_obj_bpool(obj, 1);
+	if (pool == (xfat_bpool_t*)0) {
+		return FS_ERR_PARAM;
+	}
+
+	xfat_err_t io_err = bpool_io_wait();
+	if (io_err < 0) {
+		return io_err;
+	}
+
+	if (obj->type == XFAT_OBJ_FAT) {
+		xfat_t* xfat = to_type(obj, xfat_t);
+		bpool_invalid_sectors(&xfat->fat_bpool, start_sector, count);
+		bpool_invalid_sectors(&xfat->dir_bpool, start_sector, count);
+	}
+
+	return bpool_invalid_sectors(pool, start_sector, count);
+}
+
+/**
+ * 设置缓存池的直通模式：磁盘驱动支持内存映射时，缓存直接指向映射中的扇区，读取时不再拷贝，
+ * 回写时用驱动的sync_sector同步修改过的范围。切换前回写并清空该缓存池
+ */
+xfat_err_t xfat_bpool_set_map(xfat_obj_t* obj, xfat_bpool_part_t part, u8_t enable) {
+	xfat_bpool_t* pool = get_obj_part_bpool(obj, part);
+	xdisk_t* disk = get_obj_disk(obj);
+	if ((pool == (xfat_bpool_t*)0) || (enable && (xdisk_map_sector(disk, 0, 1) == (u8_t*)0))) {
+		return FS_ERR_PARAM;
+	}
+
+	xfat_err_t io_err = bpool_io_wait_pool(pool);
+	if (io_err < 0) {
+		return io_err;
+	}
+
+	enable = enable ? 1 : 0;
+	if (pool->map_mode == enable) {
+		return FS_ERR_OK;
+	}
+
+	if (pool->pin_count > 0) {
+		return FS_ERR_NO_BUFFER;
+	}
+
+	xfat_err_t err = bpool_flush_sectors(obj, pool, 0, 0xFFFFFFFF);
+	if (err < 0) {
+		return err;
+	}
+
+	err = bpool_invalid_sectors(pool, 0, 0xFFFFFFFF);
+	if (err < 0) {
+		return err;
+	}
+
+	// 缓存重新指向缓存池自己的扇区缓冲，布局与xfat_bpool_init_part一致
+	u8_t* sector_buf_start = (u8_t*)(pool->hash_tbl + pool->hash_size);
+	xfat_buf_t* buf_start = (xfat_buf_t*)pool->mem;
+	for (u32_t i = 0; i < pool->size; i++) {
+		buf_start[i].buf = sector_buf_start + i * disk->sector_size;
+	}
+
+	pool->map_mode = enable;
+	return FS_ERR_OK;
+}
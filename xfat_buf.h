@@ -4,36 +4,114 @@
 #include "xtypes.h"
 #include "xfat_obj.h"
 
-#define XFAT_BUF_STATE_FREE        (0 << 0)			// Уδдκ
-#define XFAT_BUF_STATE_CLEAN       (1 << 0)			// ɾδд
-#define XFAT_BUF_STATE_DIRTY       (2 << 0)			// ࣬Ѿдݣδд
-#define XFAT_BUF_STATE_MSK         (3 << 0)         // д״̬
+#define XFAT_BUF_STATE_FREE        (0 << 0)			// 扇区空闲，未被写入任何数据
+#define XFAT_BUF_STATE_CLEAN       (1 << 0)			// 扇区干净，未被写数据
+#define XFAT_BUF_STATE_DIRTY       (2 << 0)			// 扇区脏，已经被写入数据，未回写到磁盘
+#define XFAT_BUF_STATE_MSK         (3 << 0)         // 写状态掩码
+#define XFAT_BUF_HASHED            (1 << 2)         // 已加入扇区号哈希索引
+#define XFAT_BUF_HOT               (1 << 3)         // 2Q策略下位于热区
+#define XFAT_BUF_PREFETCHED        (1 << 4)         // 预先读入，尚未被访问过
 
 
 typedef struct _xfat_buf_t {
 	u8_t* buf;
 	u32_t sector_no;
 	u32_t flags;
+	u32_t hash_sector;                              // 加入哈希索引时所用的扇区号
+	u32_t stamp;                                    // 读入缓存时缓存池的未命中计数
+	u32_t ref;                                      // 固定计数，非0时不会被替换
+	u32_t dirty_stamp;                              // 变脏时缓存池的未命中计数
 
 	struct _xfat_buf_t* next;
 	struct _xfat_buf_t* pre;
+	struct _xfat_buf_t* hash_next;
 } xfat_buf_t;
 
 #define xfat_buf_state(buf) ((buf)->flags & XFAT_BUF_STATE_MSK)
 void xfat_buf_set_state(xfat_buf_t* buf, u32_t state);
 
+typedef enum _xfat_bpool_policy_t {
+	XFAT_BPOOL_LRU,                                 // 最近最少使用
+	XFAT_BPOOL_2Q,                                  // 冷热分区，抵抗大批量顺序读写的冲刷
+} xfat_bpool_policy_t;
+
+typedef enum _xfat_bpool_part_t {
+	XFAT_BPOOL_PART_DATA,                           // 文件数据，也是未分区时所有扇区共用的缓存池
+	XFAT_BPOOL_PART_FAT,                            // FAT表扇区，仅对卷对象有效
+	XFAT_BPOOL_PART_DIR,                            // 目录等其它元数据扇区，仅对卷对象有效
+} xfat_bpool_part_t;
+
+typedef struct _xfat_bpool_mem_t {
+	u8_t* (*alloc)(u32_t size);
+	void (*free)(u8_t* mem, u32_t size);
+} xfat_bpool_mem_t;
+
+typedef struct _xfat_bpool_stats_t {
+	u32_t hits;                                     // 命中次数
+	u32_t misses;                                   // 未命中次数
+	u32_t evictions;                                // 有效缓存被替换的次数
+	u32_t write_backs;                              // 脏缓存回写的扇区数
+	u32_t write_throughs;                           // 直接写穿的次数
+	u32_t flushes;                                  // 回写请求次数
+} xfat_bpool_stats_t;
+
 typedef struct _xfat_bpool_t {
 	xfat_buf_t* first;
 	xfat_buf_t* last;
 	u32_t size;
+
+	xfat_buf_t** hash_tbl;                          // 按扇区号索引的哈希桶
+	u32_t hash_size;
+	u32_t extent_sectors;                           // 未命中时一次读入的对齐扇区数，1为逐扇区读
+
+	xfat_bpool_policy_t policy;
+	xfat_buf_t* hot_last;                           // 热区最后一个缓存，热区位于链表头部
+	u32_t hot_count;
+	u32_t miss_count;
+	u32_t pin_count;                                // 被固定的缓存数
+
+	u32_t dirty_count;                              // 脏缓存数
+	u32_t dirty_ratio;                              // 脏缓存占缓存池的最大百分比，0为不限制
+	u32_t dirty_age;                                // 变脏后经过多少次未命中需回写，0为不限制
+
+	u8_t map_mode;                                  // 直通模式，缓存直接指向磁盘映射
+	u32_t map_dirty_start;                          // 直通模式下映射中待同步的扇区范围
+	u32_t map_dirty_end;
+
+	u8_t* mem;                                      // 缓存池当前使用的内存
+	u32_t mem_size;
+	u8_t mem_alloced;                               // mem由mem_ops分配，调整大小时需释放
+	const xfat_bpool_mem_t* mem_ops;
+
+	xfat_bpool_stats_t stats;
 } xfat_bpool_t;
 
-#define XFAT_BUF_SIZE(sector_size, sector_nr) ((sizeof(xfat_buf_t) + (sector_size)) * (sector_nr))
+#define XFAT_BUF_BOUNCE_SIZE       (16 * 1024)      // 合并回写、区段读入所用的中转缓冲大小
+#define XFAT_BUF_IO_MAX            16               // 一批最多同时提交的磁盘请求数
+#define XFAT_BUF_IO_BOUNCE_SIZE    (64 * 1024)      // 批量请求共用的中转缓冲大小
+#define XFAT_BUF_IO_IOV_MAX        64               // 聚集写时每个请求最多的缓冲区段数
+
+#define XFAT_BUF_SIZE(sector_size, sector_nr) ((sizeof(xfat_buf_t) + sizeof(xfat_buf_t*) + (sector_size)) * (sector_nr))
 
-xfat_err_t xfat_bpool_init(xfat_obj_t* obj, u32_t sector_size, u8_t* buffer, u32_t buf_size);
+xfat_err_t xfat_bpool_init(xfat_obj_t* obj, u32_t sector_size, u8_t* buffer, u32_t buf_size, xfat_bpool_policy_t policy);
+xfat_err_t xfat_bpool_init_part(xfat_obj_t* obj, xfat_bpool_part_t part, u32_t sector_size,
+	u8_t* buffer, u32_t buf_size, xfat_bpool_policy_t policy);
+xfat_err_t xfat_bpool_set_mem(xfat_obj_t* obj, xfat_bpool_part_t part, const xfat_bpool_mem_t* mem_ops);
+xfat_err_t xfat_bpool_resize(xfat_obj_t* obj, xfat_bpool_part_t part, u8_t* buffer, u32_t buf_size);
+xfat_err_t xfat_bpool_stats(xfat_obj_t* obj, xfat_bpool_part_t part, xfat_bpool_stats_t* stats, u8_t reset);
+xfat_err_t xfat_bpool_set_extent(xfat_obj_t* obj, u32_t sector_count);
+xfat_err_t xfat_bpool_set_map(xfat_obj_t* obj, xfat_bpool_part_t part, u8_t enable);
 xfat_err_t xfat_bpool_read_sector(xfat_obj_t* obj, xfat_buf_t** buf, u32_t sector_no);
 xfat_err_t xfat_bpool_write_sector(xfat_obj_t* obj, xfat_buf_t* buf, u8_t is_through);
+xfat_err_t xfat_bpool_pin(xfat_obj_t* obj, xfat_buf_t* buf);
+void xfat_bpool_unpin(xfat_obj_t* obj, xfat_buf_t* buf);
+u32_t xfat_bpool_prefetch_max(xfat_obj_t* obj);
+xfat_err_t xfat_bpool_prefetch(xfat_obj_t* obj, u32_t start_sector, u32_t count);
+xfat_err_t xfat_bpool_wait(xfat_obj_t* obj);
 xfat_err_t xfat_bpool_alloc(xfat_obj_t* obj, xfat_buf_t** buf, u32_t sector_no);
+xfat_err_t xfat_bpool_set_policy(xfat_obj_t* obj, xfat_bpool_part_t part, xfat_bpool_policy_t policy);
+xfat_err_t xfat_bpool_set_writeback(xfat_obj_t* obj, xfat_bpool_part_t part, u32_t dirty_ratio, u32_t dirty_age);
+xfat_err_t xfat_bpool_writeback(xfat_obj_t* obj);
 xfat_err_t xfat_bpool_flush(xfat_obj_t* obj);
 xfat_err_t xfat_bpool_flush_sectors(xfat_obj_t* obj, u32_t start_sector, u32_t count);
 xfat_err_t xfat_bpool_invalid_sectors(xfat_obj_t* obj, u32_t start_sector, u32_t count);